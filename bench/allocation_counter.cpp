@@ -0,0 +1,36 @@
+
+#include "allocation_counter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+static atomic<uint64_t> g_allocations(0);
+
+uint64_t allocation_count() {
+    return g_allocations.load(memory_order_relaxed);
+}
+
+void *operator new(size_t size) {
+    g_allocations.fetch_add(1, memory_order_relaxed);
+    void *ret = malloc(size == 0 ? 1 : size);
+    if (!ret)
+        throw bad_alloc();
+    return ret;
+}
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+void operator delete[](void *ptr) noexcept {
+    free(ptr);
+}
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+void operator delete[](void *ptr, size_t) noexcept {
+    free(ptr);
+}
@@ -0,0 +1,10 @@
+
+#ifndef DECODE_BIN_ALLOCATION_COUNTER_H
+#define DECODE_BIN_ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+// The number of calls to the global operator new so far, in any executable that links allocation_counter.cpp
+uint64_t allocation_count();
+
+#endif //DECODE_BIN_ALLOCATION_COUNTER_H
@@ -0,0 +1,230 @@
+
+// Microbenchmarks for the pieces of the interpreter which run per byte or per field.
+// Usage: decode-bin-bench [filter], runs the benchmarks whose names contain filter.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "tokenizer.h"
+#include "parser.h"
+#include "compiler.h"
+#include "allocation_counter.h"
+
+using namespace std;
+
+static const char *g_filter = nullptr;
+static volatile uint64_t g_sink;
+
+/// Runs fn until enough time has passed to get a stable measurement. Each call of fn performs ops_per_call operations.
+template<typename F>
+static void run_benchmark(const char *name, uint64_t ops_per_call, F fn) {
+    if (g_filter && !strstr(name, g_filter))
+        return;
+    fn(); // warm up
+
+    for (uint64_t iterations = 1; ; iterations *= 2) {
+        uint64_t allocations_before = allocation_count();
+        auto start = chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; i++)
+            fn();
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        uint64_t allocations = allocation_count() - allocations_before;
+
+        if (elapsed >= 200000000 || iterations >= (uint64_t(1) << 32)) {
+            double ops = double(iterations) * double(ops_per_call);
+            printf("%-40s %12.2f ns/op %10.2f allocs/op\n", name, double(elapsed) / ops, double(allocations) / ops);
+            return;
+        }
+    }
+}
+
+static vector<string> split_lines(const string &source) {
+    vector<string> lines;
+    size_t start = 0;
+    while (start <= source.length()) {
+        size_t end = source.find('\n', start);
+        if (end == string::npos)
+            end = source.length();
+        lines.push_back(source.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+static void fail(const char *what) {
+    fprintf(stderr, "%s\n", what);
+    exit(1);
+}
+
+static vector<upStatement> parse_source(const string &source) {
+    vector<string> lines = split_lines(source);
+    vector<Token> tokens;
+    vector<upStatement> statements;
+    if (!tokenize(lines, tokens, [](Token) { fail("Syntax error in benchmark source"); }))
+        fail("Syntax error in benchmark source");
+    if (!parse(tokens, statements, [](Token) { fail("Parse error in benchmark source"); }))
+        fail("Parse error in benchmark source");
+    compile(statements);
+    return statements;
+}
+
+/// A context ready to execute top level statements in, like execute() sets up
+static unique_ptr<InterpreterContext> make_context(spInputData data) {
+    auto context = make_unique<InterpreterContext>(Input(move(data)));
+    context->push_scope();
+    context->m_frames.back().current_struct = make_shared<StructRuntimeValue>();
+    declare_builtin_variables(*context);
+    declare_builtin_structs(*context);
+    return context;
+}
+
+/// A schema with a bit of everything, repeated to the given number of struct declarations
+static string synthetic_schema(int structs) {
+    string source = "byte_order(std::big_endian);\n";
+    for (int i = 0; i < structs; i++) {
+        string n = to_string(i);
+        source += "struct s" + n + " {\n"
+                  "  enum u1 kind" + n + " { A = 1; B = 2; C = 0x10; };\n"
+                  "  kind" + n + " kind;\n"
+                  "  u2 length;\n"
+                  "  switch (kind) {\n"
+                  "    case kind" + n + "::A: u4 value; break;\n"
+                  "    case kind" + n + "::B: s8 value; break;\n"
+                  "    default: u1 hide bytes[length]; print(utf8(bytes, length));\n"
+                  "  }\n"
+                  "  var i = 0;\n"
+                  "  while (i < length * 2 + 1) { i += (i << 1) | 1; }\n"
+                  "};\n";
+    }
+    return source;
+}
+
+static void bench_tokenizer_and_parser() {
+    string source = synthetic_schema(100);
+    vector<string> lines = split_lines(source);
+
+    run_benchmark("tokenize (per line)", lines.size(), [&lines]() {
+        vector<Token> tokens;
+        tokenize(lines, tokens, [](Token) {});
+        g_sink = tokens.size();
+    });
+
+    vector<Token> tokens;
+    tokenize(lines, tokens, [](Token) {});
+    run_benchmark("parse (per token)", tokens.size(), [&tokens]() {
+        vector<upStatement> statements;
+        parse(tokens, statements, [](Token) {});
+        g_sink = statements.size();
+    });
+}
+
+static void bench_operators() {
+    IntegerRuntimeValue int_a(123456), int_b(789);
+    LongRuntimeValue long_a(1234567890123LL);
+    DoubleRuntimeValue double_a(1.5);
+
+    run_benchmark("int + int", 1, [&]() { g_sink = (int_a + int_b)->m_type == RuntimeType::INT; });
+    run_benchmark("int < int", 1, [&]() { g_sink = (int_a < int_b)->to_boolean(); });
+    run_benchmark("int & int", 1, [&]() { g_sink = (int_a & int_b)->m_type == RuntimeType::INT; });
+    run_benchmark("long << int", 1, [&]() { g_sink = (long_a << int_b)->m_type == RuntimeType::LONG; });
+    run_benchmark("double * int", 1, [&]() { g_sink = (double_a * int_b)->m_type == RuntimeType::DOUBLE; });
+    run_benchmark("int to_string", 1, [&]() { g_sink = int_a.to_string().length(); });
+    run_benchmark("double to_string", 1, [&]() { g_sink = double_a.to_string().length(); });
+}
+
+static void bench_resolve_variable() {
+    for (int depth : {1, 8, 32}) {
+        auto context = make_context(make_shared<vector<uint8_t>>());
+        context->declare_variable("outer") = make_shared<IntegerRuntimeValue>(1);
+        for (int i = 0; i < depth; i++) {
+            context->push_scope();
+            context->declare_variable("local" + to_string(i)) = make_shared<IntegerRuntimeValue>(i);
+        }
+        string name = "resolve_variable depth " + to_string(depth);
+        run_benchmark(name.c_str(), 1, [&context]() { g_sink = context->resolve_variable("outer")->m_type == RuntimeType::INT; });
+    }
+}
+
+static void bench_switch() {
+    // the same switch with constant labels, which get a jump table, and with labels that have to be evaluated
+    string cases;
+    for (int i = 0; i < 14; i++)
+        cases += "case k::C" + to_string(i) + ": n += " + to_string(i) + "; break;\n";
+    string members;
+    for (int i = 0; i < 14; i++)
+        members += "C" + to_string(i) + " = " + to_string(i * 3 + 1) + ";\n";
+    string dynamic_cases;
+    for (int i = 0; i < 14; i++)
+        dynamic_cases += "case c" + to_string(i) + ": n += " + to_string(i) + "; break;\n";
+
+    string source = "enum u1 k {\n" + members + "};\n"
+                    "var x = 40, n = 0;\n"
+                    "switch (x) {\n" + cases + "}\n"
+                    "switch (x) {\n" + dynamic_cases + "}\n";
+    vector<upStatement> statements = parse_source(source);
+    auto context = make_context(make_shared<vector<uint8_t>>());
+    for (int i = 0; i < 14; i++)
+        context->declare_variable("c" + to_string(i)) = make_shared<IntegerRuntimeValue>(i * 3 + 1);
+    context->execute_statement(*statements[0]);
+    context->execute_statement(*statements[1]);
+
+    Statement &constant_switch = *statements[2];
+    Statement &dynamic_switch = *statements[3];
+    run_benchmark("switch, 14 constant labels", 1, [&]() { context->execute_statement(constant_switch); });
+    run_benchmark("switch, 14 evaluated labels", 1, [&]() { context->execute_statement(dynamic_switch); });
+}
+
+static void bench_struct_ref_arrays() {
+    const int count = 4096;
+    auto data = make_shared<vector<uint8_t>>(count * 8);
+    for (size_t i = 0; i < data->size(); i++)
+        (*data)[i] = static_cast<uint8_t>(i * 7);
+
+    // The arrays are read back, though that's never run, so they're decoded and kept rather than skipped over,
+    // which is what's being measured
+    vector<upStatement> statements = parse_source(
+            "struct pair { u1 a; u1 b; };\n"
+            "u2 hide values[" + to_string(count) + "];\n"
+            "u2 hide grid[64][" + to_string(count / 64) + "];\n"
+            "pair hide pairs[" + to_string(count) + "];\n"
+            "u1 hide bytes[" + to_string(count) + "];\n"
+            "print(values[0] + bytes[0]);\n"
+            "print(grid[0]);\n"
+            "print(pairs[0]);\n");
+    auto context = make_context(data);
+    context->execute_statement(*statements[0]);
+
+    auto run_array = [&context](Statement &statement) {
+        // a fresh struct each time so the name can be defined again
+        context->push_scope();
+        context->m_frames.back().current_struct = make_shared<StructRuntimeValue>();
+        context->input().seek(0);
+        context->execute_statement(statement);
+        context->pop_scope();
+    };
+    run_benchmark("struct ref array u2 (per element)", count, [&]() { run_array(*statements[1]); });
+    run_benchmark("struct ref array u2 2d (per element)", count, [&]() { run_array(*statements[2]); });
+    run_benchmark("struct ref array struct (per element)", count, [&]() { run_array(*statements[3]); });
+    run_benchmark("struct ref array u1 (per element)", count, [&]() { run_array(*statements[4]); });
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1)
+        g_filter = argv[1];
+
+    try {
+        bench_tokenizer_and_parser();
+        bench_operators();
+        bench_resolve_variable();
+        bench_switch();
+        bench_struct_ref_arrays();
+    } catch (const char *error) {
+        fail(error);
+    } catch (string &error) {
+        fail(error.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,275 @@
+
+// Writes synthetic Java class files which decode with examples/class.binformat, for end to end throughput numbers.
+// Usage: decode-bin-gen-class [options] <output_dir> <count>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+using namespace std;
+
+struct GeneratorOptions {
+    // constant pool slots, longs and doubles take two
+    int constant_pool = 200;
+    // average Utf8 entry length in bytes
+    int utf8_length = 24;
+    int interfaces = 3;
+    uint32_t seed = 1;
+};
+
+enum CpTag : uint8_t {
+    CONSTANT_Utf8 = 1, CONSTANT_Integer = 3, CONSTANT_Float = 4, CONSTANT_Long = 5, CONSTANT_Double = 6,
+    CONSTANT_Class = 7, CONSTANT_String = 8, CONSTANT_Fieldref = 9, CONSTANT_Methodref = 10,
+    CONSTANT_InterfaceMethodref = 11, CONSTANT_NameAndType = 12, CONSTANT_MethodHandle = 15,
+    CONSTANT_MethodType = 16, CONSTANT_InvokeDynamic = 18
+};
+
+// roughly the mix in real class files, Utf8 and the ref types dominate
+static const struct {
+    CpTag tag;
+    int weight;
+} TAG_WEIGHTS[] = {
+        {CONSTANT_Utf8, 45}, {CONSTANT_Class, 12}, {CONSTANT_Methodref, 12}, {CONSTANT_NameAndType, 10},
+        {CONSTANT_Fieldref, 5}, {CONSTANT_String, 5}, {CONSTANT_InterfaceMethodref, 2}, {CONSTANT_Integer, 2},
+        {CONSTANT_Float, 1}, {CONSTANT_Long, 1}, {CONSTANT_Double, 1}, {CONSTANT_MethodHandle, 1},
+        {CONSTANT_MethodType, 1}, {CONSTANT_InvokeDynamic, 1},
+};
+
+class ClassWriter {
+    vector<uint8_t> &m_out;
+public:
+    explicit ClassWriter(vector<uint8_t> &out) : m_out(out) {}
+
+    void u1(uint64_t value) { m_out.push_back(static_cast<uint8_t>(value)); }
+    void u2(uint64_t value) { u1(value >> 8); u1(value); }
+    void u4(uint64_t value) { u2(value >> 16); u2(value); }
+    void u8(uint64_t value) { u4(value >> 32); u4(value); }
+};
+
+/// Appends the modified UTF-8 encoding of a UTF-16 code unit
+static void append_mutf8_unit(string &out, uint32_t unit) {
+    if (unit != 0 && unit < 0x80) {
+        out += static_cast<char>(unit);
+    } else if (unit < 0x800) {
+        out += static_cast<char>(0xc0 | (unit >> 6));
+        out += static_cast<char>(0x80 | (unit & 0x3f));
+    } else {
+        out += static_cast<char>(0xe0 | (unit >> 12));
+        out += static_cast<char>(0x80 | ((unit >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (unit & 0x3f));
+    }
+}
+
+/// Mostly identifier characters, with some of everything modified UTF-8 has to handle
+static string random_mutf8(mt19937 &rng, size_t length) {
+    static const char IDENTIFIER_CHARS[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_$/;()[<>";
+    string ret;
+    while (ret.length() < length) {
+        uint32_t kind = rng() % 100;
+        if (kind < 90) {
+            ret += IDENTIFIER_CHARS[rng() % (sizeof(IDENTIFIER_CHARS) - 1)];
+        } else if (kind < 95) {
+            append_mutf8_unit(ret, 0xc0 + rng() % 0x40);
+        } else if (kind < 98) {
+            append_mutf8_unit(ret, 0x4e00 + rng() % 0x5000);
+        } else if (kind < 99) {
+            // a supplementary character as a surrogate pair
+            uint32_t code_point = 0x10000 + rng() % 0x100000;
+            append_mutf8_unit(ret, 0xd800 + ((code_point - 0x10000) >> 10));
+            append_mutf8_unit(ret, 0xdc00 + ((code_point - 0x10000) & 0x3ff));
+        } else {
+            append_mutf8_unit(ret, 0);
+        }
+    }
+    return ret;
+}
+
+static vector<uint8_t> generate_class_file(mt19937 &rng, const GeneratorOptions &options) {
+    // decide the layout first, so entries can refer to any other entry of the right type
+    vector<CpTag> tags = {CONSTANT_Utf8, CONSTANT_Class};
+    int slots = 2;
+    int total_weight = 0;
+    for (auto &entry : TAG_WEIGHTS)
+        total_weight += entry.weight;
+    while (slots < options.constant_pool) {
+        int choice = static_cast<int>(rng() % total_weight);
+        CpTag tag = TAG_WEIGHTS[0].tag;
+        for (auto &entry : TAG_WEIGHTS) {
+            if (choice < entry.weight) {
+                tag = entry.tag;
+                break;
+            }
+            choice -= entry.weight;
+        }
+        bool wide = tag == CONSTANT_Long || tag == CONSTANT_Double;
+        if (wide && slots + 2 > options.constant_pool) {
+            tag = CONSTANT_Utf8;
+            wide = false;
+        }
+        tags.push_back(tag);
+        slots += wide ? 2 : 1;
+    }
+
+    vector<uint16_t> utf8_indices, class_indices, name_and_type_indices, ref_indices;
+    uint16_t index = 1;
+    for (CpTag tag : tags) {
+        if (tag == CONSTANT_Utf8)
+            utf8_indices.push_back(index);
+        else if (tag == CONSTANT_Class)
+            class_indices.push_back(index);
+        else if (tag == CONSTANT_NameAndType)
+            name_and_type_indices.push_back(index);
+        else if (tag == CONSTANT_Fieldref || tag == CONSTANT_Methodref || tag == CONSTANT_InterfaceMethodref)
+            ref_indices.push_back(index);
+        index += tag == CONSTANT_Long || tag == CONSTANT_Double ? 2 : 1;
+    }
+    auto pick = [&rng](const vector<uint16_t> &indices) -> uint16_t {
+        return indices.empty() ? 1 : indices[rng() % indices.size()];
+    };
+
+    vector<uint8_t> data;
+    ClassWriter out(data);
+    out.u4(0xcafebabe);
+    out.u2(0);
+    out.u2(52);
+    out.u2(slots + 1);
+    for (CpTag tag : tags) {
+        out.u1(tag);
+        switch (tag) {
+            case CONSTANT_Utf8: {
+                size_t length = options.utf8_length == 0 ? 0 : rng() % (2 * options.utf8_length + 1);
+                string value = random_mutf8(rng, min<size_t>(length, 0xfff0));
+                out.u2(value.length());
+                data.insert(data.end(), value.begin(), value.end());
+                break;
+            }
+            case CONSTANT_Integer:
+                out.u4(rng());
+                break;
+            case CONSTANT_Float: {
+                float value = uniform_real_distribution<float>(-1e6f, 1e6f)(rng);
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                out.u4(bits);
+                break;
+            }
+            case CONSTANT_Long:
+                out.u8((uint64_t(rng()) << 32) | rng());
+                break;
+            case CONSTANT_Double: {
+                double value = uniform_real_distribution<double>(-1e12, 1e12)(rng);
+                uint64_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                out.u8(bits);
+                break;
+            }
+            case CONSTANT_Class:
+            case CONSTANT_String:
+            case CONSTANT_MethodType:
+                out.u2(pick(utf8_indices));
+                break;
+            case CONSTANT_Fieldref:
+            case CONSTANT_Methodref:
+            case CONSTANT_InterfaceMethodref:
+                out.u2(pick(class_indices));
+                out.u2(pick(name_and_type_indices));
+                break;
+            case CONSTANT_NameAndType:
+                out.u2(pick(utf8_indices));
+                out.u2(pick(utf8_indices));
+                break;
+            case CONSTANT_MethodHandle:
+                out.u1(1 + rng() % 9);
+                out.u2(pick(ref_indices));
+                break;
+            case CONSTANT_InvokeDynamic:
+                out.u2(rng() % 16);
+                out.u2(pick(name_and_type_indices));
+                break;
+        }
+    }
+
+    out.u2(0x21); // acc_public | acc_super
+    out.u2(pick(class_indices));
+    out.u2(rng() % 8 == 0 ? 0 : pick(class_indices));
+    out.u2(options.interfaces);
+    for (int i = 0; i < options.interfaces; i++)
+        out.u2(pick(class_indices));
+    return data;
+}
+
+static void print_usage(const char *program_name) {
+    printf("%s [options] <output_dir> <count>\n", program_name);
+    printf("Options:\n");
+    printf("  --constant-pool N  constant pool slots per class (default 200)\n");
+    printf("  --utf8-length N    average Utf8 entry length in bytes (default 24)\n");
+    printf("  --interfaces N     interfaces per class (default 3)\n");
+    printf("  --seed N           random seed, the same seed gives the same files (default 1)\n");
+}
+
+int main(int argc, char **argv) {
+    GeneratorOptions options;
+    vector<char*> positional_args;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        int *int_option = nullptr;
+        if (arg == "--constant-pool")
+            int_option = &options.constant_pool;
+        else if (arg == "--utf8-length")
+            int_option = &options.utf8_length;
+        else if (arg == "--interfaces")
+            int_option = &options.interfaces;
+
+        if (int_option || arg == "--seed") {
+            if (i + 1 == argc) {
+                fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                return 1;
+            }
+            long value = strtol(argv[++i], nullptr, 10);
+            if (int_option)
+                *int_option = static_cast<int>(value);
+            else
+                options.seed = static_cast<uint32_t>(value);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            positional_args.push_back(argv[i]);
+        }
+    }
+    if (positional_args.size() != 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (options.constant_pool < 2 || options.constant_pool > 0xfff0 || options.utf8_length < 0 ||
+        options.interfaces < 0 || options.interfaces > 0xffff) {
+        fprintf(stderr, "Option out of range\n");
+        return 1;
+    }
+
+    string output_dir = positional_args[0];
+    long count = strtol(positional_args[1], nullptr, 10);
+    mkdir(output_dir.c_str(), 0777);
+
+    mt19937 rng(options.seed);
+    uint64_t total_bytes = 0;
+    for (long i = 0; i < count; i++) {
+        vector<uint8_t> data = generate_class_file(rng, options);
+        char filename[32];
+        snprintf(filename, sizeof(filename), "/C%06ld.class", i);
+        string path = output_dir + filename;
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file || fwrite(data.data(), 1, data.size(), file) != data.size() || fclose(file) != 0) {
+            fprintf(stderr, "Failed to write %s\n", path.c_str());
+            return 1;
+        }
+        total_bytes += data.size();
+    }
+    printf("Wrote %ld class files, %llu bytes, to %s\n", count, static_cast<unsigned long long>(total_bytes), output_dir.c_str());
+    return 0;
+}
@@ -0,0 +1,57 @@
+# Decodes a check's input with its binformat and compares the output with what's expected, see bench/checks.
+# Run by ctest with -DDECODE_BIN=<decode-bin> -DCHECK=<bench/checks/name, without an extension> -DWORK_DIR=<dir>
+# <name>.error is for checks where decode-bin should fail: each of its lines must be in what it writes to stderr.
+# <name>.stderr is the same for checks where it should succeed, for what options such as --profile write there.
+# <name>.resume is a number of bytes: the input is cut short there for a first run, which checkpoints after every top
+# level statement, and then a second run resumes from the checkpoint with the whole input, appending to the same
+# output. Together they should output what decoding the whole input at once does.
+set(args "")
+if (EXISTS ${CHECK}.args)
+    file(READ ${CHECK}.args args)
+    separate_arguments(args UNIX_COMMAND "${args}")
+endif ()
+if (EXISTS ${CHECK}.resume)
+    file(READ ${CHECK}.resume cut)
+    string(STRIP "${cut}" cut)
+    get_filename_component(name ${CHECK} NAME)
+    set(work ${WORK_DIR}/${name})
+    file(MAKE_DIRECTORY ${WORK_DIR})
+    file(REMOVE ${work}.checkpoint)
+    execute_process(COMMAND head -c ${cut} ${CHECK}.bin OUTPUT_FILE ${work}.bin)
+    # this one is expected to fail at the end of its input
+    execute_process(COMMAND ${DECODE_BIN} ${args} --checkpoint-every 1 --checkpoint ${work}.checkpoint
+                ${CHECK}.binformat ${work}.bin
+            OUTPUT_FILE ${work}.out
+            ERROR_QUIET)
+    # resuming cuts the output file back to where the checkpoint was, so it's opened to append to like >> would
+    execute_process(COMMAND sh -c "\"$@\" >> \"$0\"" ${work}.out
+                ${DECODE_BIN} ${args} --resume --checkpoint ${work}.checkpoint ${CHECK}.binformat ${CHECK}.bin
+            ERROR_VARIABLE errors
+            RESULT_VARIABLE result)
+    file(READ ${work}.out output)
+else ()
+    execute_process(COMMAND ${DECODE_BIN} ${args} ${CHECK}.binformat ${CHECK}.bin
+            OUTPUT_VARIABLE output
+            ERROR_VARIABLE errors
+            RESULT_VARIABLE result)
+endif ()
+if (EXISTS ${CHECK}.error)
+    if (result EQUAL 0)
+        message(FATAL_ERROR "decode-bin succeeded but was expected to fail")
+    endif ()
+    file(STRINGS ${CHECK}.error expected_errors)
+elseif (NOT result EQUAL 0)
+    message(FATAL_ERROR "decode-bin failed with ${result}:\n${errors}")
+elseif (EXISTS ${CHECK}.stderr)
+    file(STRINGS ${CHECK}.stderr expected_errors)
+endif ()
+foreach (line ${expected_errors})
+    string(FIND "${errors}" "${line}" position)
+    if (position EQUAL -1)
+        message(FATAL_ERROR "Expected a line with:\n${line}\nin the errors:\n${errors}")
+    endif ()
+endforeach ()
+file(READ ${CHECK}.expected expected)
+if (NOT output STREQUAL expected)
+    message(FATAL_ERROR "Expected:\n${expected}\nbut got:\n${output}")
+endif ()
@@ -0,0 +1,268 @@
+
+// Decodes every file in a directory with one binformat, and reports end to end throughput.
+// Usage: decode-bin-throughput [options] <binformat_file> <corpus_dir>
+// The schema is parsed once, the files are read into memory before timing starts and output goes to /dev/null,
+// so this measures the interpreter rather than the disk or the terminal.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/resource.h>
+#include "tokenizer.h"
+#include "parser.h"
+#include "compiler.h"
+#include "allocation_counter.h"
+
+using namespace std;
+
+struct ThroughputResult {
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    double mb_per_s = 0;
+    double files_per_s = 0;
+    double allocations_per_file = 0;
+    long peak_rss_kb = 0;
+};
+
+static void print_usage(const char *program_name) {
+    printf("%s [options] <binformat_file> <corpus_dir>\n", program_name);
+    printf("Options:\n");
+    printf("  --repeat N              decode the corpus N times (default 3)\n");
+    printf("  --baseline FILE         compare against a baseline written by --write-baseline, fail on regressions in\n");
+    printf("                          allocations or peak memory (throughput is only reported, it depends on the machine)\n");
+    printf("  --write-baseline FILE   write the results as a baseline\n");
+    printf("  --tolerance X           allowed relative regression against the baseline (default 0.2)\n");
+}
+
+static bool parse_schema(const char *filename, vector<upStatement> &statements) {
+    ifstream file(filename);
+    if (file.fail()) {
+        fprintf(stderr, "Failed to open binformat file\n");
+        return false;
+    }
+    vector<string> lines;
+    string line;
+    while (getline(file, line))
+        lines.push_back(line);
+
+    auto report = [](const char *what) {
+        return [what](Token t) { fprintf(stderr, "%s %d:%d\n", what, t.line, t.col); };
+    };
+    vector<Token> tokens;
+    if (!tokenize(lines, tokens, report("Syntax error")) || !parse(tokens, statements, report("Parsing error")))
+        return false;
+    compile(statements);
+    return true;
+}
+
+static bool read_corpus(const string &dir, vector<spInputData> &files, uint64_t &bytes) {
+    DIR *handle = opendir(dir.c_str());
+    if (!handle) {
+        fprintf(stderr, "Failed to open corpus directory %s\n", dir.c_str());
+        return false;
+    }
+    vector<string> names;
+    while (dirent *entry = readdir(handle)) {
+        if (entry->d_name[0] != '.')
+            names.emplace_back(entry->d_name);
+    }
+    closedir(handle);
+    sort(names.begin(), names.end());
+
+    for (const string &name : names) {
+        auto data = make_shared<vector<uint8_t>>();
+        if (!read_input_file(dir + "/" + name, *data)) {
+            fprintf(stderr, "Failed to read %s\n", name.c_str());
+            return false;
+        }
+        bytes += data->size();
+        files.push_back(move(data));
+    }
+    if (files.empty()) {
+        fprintf(stderr, "No files in %s\n", dir.c_str());
+        return false;
+    }
+    return true;
+}
+
+/// Finds "key": number in a flat JSON object, which is all a baseline file is
+static bool json_number(const string &json, const char *key, double &value) {
+    string quoted = "\"" + string(key) + "\"";
+    size_t position = json.find(quoted);
+    if (position == string::npos)
+        return false;
+    position = json.find(':', position + quoted.length());
+    if (position == string::npos)
+        return false;
+    char *end;
+    value = strtod(json.c_str() + position + 1, &end);
+    return end != json.c_str() + position + 1;
+}
+
+static bool write_baseline(const char *filename, const ThroughputResult &result) {
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        return false;
+    fprintf(file, "{\n");
+    fprintf(file, "  \"files\": %llu,\n", static_cast<unsigned long long>(result.files));
+    fprintf(file, "  \"bytes\": %llu,\n", static_cast<unsigned long long>(result.bytes));
+    fprintf(file, "  \"mb_per_s\": %.2f,\n", result.mb_per_s);
+    fprintf(file, "  \"files_per_s\": %.1f,\n", result.files_per_s);
+    fprintf(file, "  \"allocations_per_file\": %.1f,\n", result.allocations_per_file);
+    fprintf(file, "  \"peak_rss_kb\": %ld\n", result.peak_rss_kb);
+    fprintf(file, "}\n");
+    return fclose(file) == 0;
+}
+
+/// Returns false if any metric regressed by more than tolerance. The throughputs are only reported, since the baseline
+/// was probably measured on another machine, and a slower one than this would make them fail for no reason.
+static bool compare_baseline(const char *filename, const ThroughputResult &result, double tolerance) {
+    ifstream file(filename);
+    if (file.fail()) {
+        fprintf(stderr, "Failed to open baseline %s\n", filename);
+        return false;
+    }
+    string json((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    double baseline_bytes;
+    if (json_number(json, "bytes", baseline_bytes) && static_cast<uint64_t>(baseline_bytes) != result.bytes)
+        printf("warning: the baseline was measured on a different corpus (%.0f bytes, not %llu)\n",
+               baseline_bytes, static_cast<unsigned long long>(result.bytes));
+
+    // higher is better for the throughputs, lower is better for the rest
+    struct Metric {
+        const char *key;
+        double value;
+        bool higher_is_better;
+        bool checked;
+    } metrics[] = {
+            {"mb_per_s", result.mb_per_s, true, false},
+            {"files_per_s", result.files_per_s, true, false},
+            {"allocations_per_file", result.allocations_per_file, false, true},
+            {"peak_rss_kb", static_cast<double>(result.peak_rss_kb), false, true},
+    };
+    bool ok = true;
+    for (Metric &metric : metrics) {
+        double baseline;
+        if (!json_number(json, metric.key, baseline)) {
+            printf("%-22s missing from baseline\n", metric.key);
+            continue;
+        }
+        double change = baseline == 0 ? 0 : (metric.value - baseline) / baseline;
+        bool regressed = metric.checked && (metric.higher_is_better ? change < -tolerance : change > tolerance);
+        printf("%-22s %12.2f baseline %12.2f %+7.1f%%%s\n", metric.key, metric.value, baseline, change * 100,
+               regressed ? "  REGRESSION" : metric.checked ? "" : "  (not checked)");
+        ok = ok && !regressed;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int repeat = 3;
+    const char *baseline = nullptr;
+    const char *new_baseline = nullptr;
+    double tolerance = 0.2;
+    vector<char*> positional_args;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool takes_value = arg == "--repeat" || arg == "--baseline" || arg == "--write-baseline" || arg == "--tolerance";
+        if (takes_value && i + 1 == argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return 1;
+        }
+        if (arg == "--repeat") {
+            repeat = max(1, atoi(argv[++i]));
+        } else if (arg == "--baseline") {
+            baseline = argv[++i];
+        } else if (arg == "--write-baseline") {
+            new_baseline = argv[++i];
+        } else if (arg == "--tolerance") {
+            tolerance = atof(argv[++i]);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            positional_args.push_back(argv[i]);
+        }
+    }
+    if (positional_args.size() != 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    vector<upStatement> statements;
+    if (!parse_schema(positional_args[0], statements))
+        return 1;
+    vector<spInputData> files;
+    uint64_t corpus_bytes = 0;
+    if (!read_corpus(positional_args[1], files, corpus_bytes))
+        return 1;
+
+    FILE *null_output = fopen("/dev/null", "w");
+    if (!null_output) {
+        fprintf(stderr, "Failed to open /dev/null\n");
+        return 1;
+    }
+    InterpreterOptions options;
+    options.output_file = null_output;
+
+    uint64_t failures = 0;
+    string first_error;
+    auto error_handler = [&failures, &first_error](string &error, vector<Statement*> &, vector<Expression*> &) {
+        if (failures++ == 0)
+            first_error = error;
+    };
+
+    // one untimed pass so the first files don't pay for warming up the allocator and caches
+    for (spInputData &data : files)
+        execute(statements, Input(data), options, error_handler);
+
+    uint64_t allocations_before = allocation_count();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < repeat; i++) {
+        for (spInputData &data : files)
+            execute(statements, Input(data), options, error_handler);
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t allocations = allocation_count() - allocations_before;
+    fclose(null_output);
+
+    if (failures != 0) {
+        fprintf(stderr, "%llu decodes failed, the first with: %s\n", static_cast<unsigned long long>(failures), first_error.c_str());
+        return 1;
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    ThroughputResult result;
+    uint64_t decoded_files = files.size() * repeat;
+    result.files = files.size();
+    result.bytes = corpus_bytes;
+    result.mb_per_s = double(corpus_bytes) * repeat / elapsed / (1024 * 1024);
+    result.files_per_s = double(decoded_files) / elapsed;
+    result.allocations_per_file = double(allocations) / decoded_files;
+    result.peak_rss_kb = usage.ru_maxrss;
+
+    printf("%llu files, %llu bytes, decoded %d times in %.3fs\n", static_cast<unsigned long long>(result.files),
+           static_cast<unsigned long long>(result.bytes), repeat, elapsed);
+    printf("%-22s %12.2f\n", "mb_per_s", result.mb_per_s);
+    printf("%-22s %12.2f\n", "files_per_s", result.files_per_s);
+    printf("%-22s %12.2f\n", "allocations_per_file", result.allocations_per_file);
+    printf("%-22s %12ld\n", "peak_rss_kb", result.peak_rss_kb);
+
+    if (new_baseline && !write_baseline(new_baseline, result)) {
+        fprintf(stderr, "Failed to write baseline %s\n", new_baseline);
+        return 1;
+    }
+    if (baseline && !compare_baseline(baseline, result, tolerance))
+        return 1;
+    return 0;
+}
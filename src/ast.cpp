@@ -1,7 +1,8 @@
 
+#include <algorithm>
 #include <limits>
-#include <sstream>
 #include "ast.h"
+#include "compression.h"
 
 using namespace std;
 
@@ -9,7 +10,7 @@ void BlockStatement::execute(InterpreterContext &context) {
     context.push_scope();
     for (upStatement &statement : m_statements) {
         context.execute_statement(*statement);
-        if (context.is_broken() || context.is_continued()) break;
+        if (context.is_broken() || context.is_continued() || context.is_failed()) break;
     }
     context.pop_scope();
 }
@@ -25,6 +26,7 @@ void IfStatement::execute(InterpreterContext &context) {
 void WhileStatement::execute(InterpreterContext &context) {
     while (context.evaluate_expression(*m_condition)->to_boolean()) {
         context.execute_statement(*m_body);
+        if (context.is_failed()) break;
         if (context.is_broken()) {
             context.handle_break();
             break;
@@ -36,6 +38,7 @@ void WhileStatement::execute(InterpreterContext &context) {
 void DoWhileStatement::execute(InterpreterContext &context) {
     do {
         context.execute_statement(*m_body);
+        if (context.is_failed()) break;
         if (context.is_broken()) {
             context.handle_break();
             break;
@@ -44,15 +47,64 @@ void DoWhileStatement::execute(InterpreterContext &context) {
     } while (context.evaluate_expression(*m_condition)->to_boolean());
 }
 
+void DeflateStatement::execute(InterpreterContext &context) {
+    spRuntimeValue length_value = context.evaluate_expression(*m_length);
+    if (length_value->m_type != RuntimeType::INT) throw "deflate length must be an integer, not " + length_value->to_string();
+    int32_t length = dynamic_cast<IntegerRuntimeValue&>(*length_value).m_value;
+    if (length < 0) throw "Negative deflate length " + length_value->to_string();
+    if (!context.check_remaining(static_cast<size_t>(length)))
+        return;
+
+    size_t offset = context.input().offset();
+    const uint8_t *compressed = context.input().read(static_cast<size_t>(length));
+    auto inflated = make_shared<vector<uint8_t>>();
+    string error;
+    if (!inflate_data(compressed, static_cast<size_t>(length), Compression::RAW_DEFLATE, *inflated, error)) {
+        context.fail(DecodeFailure::malformed(offset, "invalid deflate data, " + error));
+        return;
+    }
+    context.execute_substream(Input(inflated), *m_body);
+}
+
+bool SwitchStatement::to_jump_table_key(RuntimeValue &value, int64_t &key) {
+    switch (value.m_type) {
+        case RuntimeType::INT:
+            key = dynamic_cast<IntegerRuntimeValue&>(value).m_value;
+            return true;
+        case RuntimeType::LONG:
+            key = dynamic_cast<LongRuntimeValue&>(value).m_value;
+            return true;
+        case RuntimeType::BOOLEAN:
+            key = dynamic_cast<BooleanRuntimeValue&>(value).m_value;
+            return true;
+        default:
+            return false;
+    }
+}
+
 void SwitchStatement::execute(InterpreterContext &context) {
     spRuntimeValue to_match = context.evaluate_expression(*m_value);
     int target = -1;
 
-    for (pair<upExpression, int> &case_label : m_case_labels) {
-        spRuntimeValue value = context.evaluate_expression(*case_label.first);
-        if (to_match == value) {
-            target = case_label.second;
-            break;
+    int64_t key;
+    if (m_has_jump_table && to_jump_table_key(*to_match, key)) {
+        if (!m_dense_jump_table.empty()) {
+            // unsigned comparison also catches key < min
+            auto offset = static_cast<uint64_t>(key) - static_cast<uint64_t>(m_jump_table_min);
+            if (offset < m_dense_jump_table.size())
+                target = m_dense_jump_table[offset];
+        } else {
+            auto itr = lower_bound(m_sparse_jump_table.begin(), m_sparse_jump_table.end(), make_pair(key, numeric_limits<int>::min()));
+            if (itr != m_sparse_jump_table.end() && itr->first == key)
+                target = itr->second;
+        }
+    } else {
+        for (pair<upExpression, int> &case_label : m_case_labels) {
+            spRuntimeValue value = context.evaluate_expression(*case_label.first);
+            if ((*to_match == *value)->to_boolean()) {
+                target = case_label.second;
+                break;
+            }
         }
     }
     if (target == -1)
@@ -61,6 +113,7 @@ void SwitchStatement::execute(InterpreterContext &context) {
     context.push_scope();
     for (int i = target; i < m_statements.size(); i++) {
         context.execute_statement(*m_statements[i]);
+        if (context.is_failed()) break;
         if (context.is_broken()) {
             context.handle_break();
             break;
@@ -97,7 +150,7 @@ void VarDeclStatement::execute(InterpreterContext &context) {
 }
 
 void AssignmentStatement::execute(InterpreterContext &context) {
-    spRuntimeValue &var_handle = context.resolve_variable(m_name);
+    spRuntimeValue &var_handle = context.assign_variable(m_name);
 
     if (var_handle == nullptr && !m_is_assign_only)
         throw "Reference to undefined variable " + m_name;
@@ -106,70 +159,151 @@ void AssignmentStatement::execute(InterpreterContext &context) {
 
     if (m_is_assign_only)
         var_handle = value;
-    else
+    else if (!(m_in_place && var_handle.use_count() == 1 && m_in_place(*var_handle, *value)))
         var_handle = m_operator(*var_handle, *value);
 }
 
 void BuiltinFunctionStatement::execute(InterpreterContext &context) {
-    vector<RuntimeValue*> args(m_args.size());
-    for (int i = 0; i < m_args.size(); i++)
-        args[i] = &*context.evaluate_expression(*m_args[i]);
+    spRuntimeValue args[MAX_BUILTIN_ARGS];
+    size_t arg_count = m_args.size();
+    for (size_t i = 0; i < arg_count; i++)
+        args[i] = context.evaluate_expression(*m_args[i]);
 
-    context.execute_builtin_function(m_name, args);
+    m_function->function(context, args, arg_count);
 }
 
+/// Decodes the elements in order with one index per dimension, rather than recursing for each dimension. arrays holds
+/// the array being filled at each dimension, unless nothing reads the values back.
 spRuntimeValue define_struct_ref_array(
         Struct &type,
         string &name,
         map<StructRefModifierType, shared_ptr<void>> &modifiers,
         vector<int> &dimensions,
-        int dim_index,
-        vector<int> &indices,
+        bool retain,
         InterpreterContext &context) {
 
-    if (dim_index == dimensions.size()) {
-        stringstream element_name;
-        element_name << name;
-        for (int index : indices)
-            element_name << "[" << index << "]";
-        spStructRuntimeValue struct_ref = context.begin_struct_ref(element_name.str(), modifiers);
-        context.execute_struct(type, struct_ref);
-        context.end_struct_ref();
-        return struct_ref;
+    size_t innermost = dimensions.size() - 1;
+    vector<int> indices(dimensions.size());
+    vector<shared_ptr<ArrayRuntimeValue>> arrays(dimensions.size());
+    if (retain)
+        arrays[0] = make_shared<ArrayRuntimeValue>(dimensions[0]);
+    size_t dim_index = 0;
+    while (true) {
+        if (indices[dim_index] >= dimensions[dim_index]) {
+            if (dim_index == 0)
+                break;
+            dim_index--;
+            indices[dim_index]++;
+            continue;
+        }
+        if (dim_index < innermost) {
+            dim_index++;
+            indices[dim_index] = 0;
+            if (retain) {
+                arrays[dim_index] = make_shared<ArrayRuntimeValue>(dimensions[dim_index]);
+                (*arrays[dim_index - 1]->m_values)[indices[dim_index - 1]] = arrays[dim_index];
+            }
+            continue;
+        }
+
+        // structs declared with array_value can move the index along
+        int index = indices[innermost];
+        context.set_array_index(&index);
+        spStructRuntimeValue struct_ref = context.begin_struct_ref(name, type, modifiers, indices.data(), indices.size());
+        spRuntimeValue value = context.execute_struct(type, struct_ref);
+        context.end_struct_ref(value);
+        if (retain)
+            (*arrays[innermost]->m_values)[indices[innermost]] = move(value);
+        if (context.is_failed())
+            break;
+        indices[innermost] = index + 1;
     }
+    return arrays[0];
+}
+
+static bool is_byte_type(Struct &type) {
+    return type.m_type == StructType::PRIMITIVE && (type.m_primitive_type == PrimitiveType::U1 || type.m_primitive_type == PrimitiveType::S1);
+}
+
+/// Arrays of bytes are viewed in the input rather than decoded element by element
+spRuntimeValue define_struct_ref_bytes(
+        Struct &type,
+        string &name,
+        map<StructRefModifierType, shared_ptr<void>> &modifiers,
+        int length,
+        InterpreterContext &context) {
 
-    auto array = make_shared<ArrayRuntimeValue>(dimensions[dim_index]);
-    for (int index = 0; index < dimensions[dim_index]; index++) {
-        indices[dim_index] = index;
-        (*array->m_values)[index] = define_struct_ref_array(type, name, modifiers, dimensions, dim_index + 1, indices, context);
+    context.begin_struct_ref(name, type, modifiers);
+    size_t offset = context.input().offset();
+    if (!context.check_remaining(static_cast<size_t>(length)))
+        length = 0;
+    context.input().read(static_cast<size_t>(length));
+    spRuntimeValue bytes = make_shared<BytesRuntimeValue>(context.input().data(), offset, length, type.m_primitive_type == PrimitiveType::S1);
+    context.end_struct_ref(bytes);
+    return bytes;
+}
+
+static vector<int> evaluate_dimensions(vector<upExpression> &dimension_expressions, InterpreterContext &context) {
+    vector<int> dimensions(dimension_expressions.size());
+    for (int i = 0; i < dimensions.size(); i++) {
+        spRuntimeValue dim = context.evaluate_expression(*dimension_expressions[i]);
+        if (dim->m_type != RuntimeType::INT) throw "Array dimension must be an integer, not " + dim->to_string();
+        int32_t dim_val = dynamic_cast<IntegerRuntimeValue&>(*dim).m_value;
+        if (dim_val < 0 || dim_val >= numeric_limits<int>::max()) {
+            string what = (dim_val < 0 ? "Negative array size " : "Array size too large ") + dim->to_string();
+            // sizes are usually decoded, so inside choose this is the input not matching rather than the schema
+            if (!context.is_speculating())
+                throw what;
+            context.fail(DecodeFailure::malformed(context.input().offset(), what));
+            dim_val = 0;
+        }
+        dimensions[i] = dim_val;
+    }
+    return dimensions;
+}
+
+/// For struct refs which nothing would see: moves past them without decoding, leaving the name undefined. Returns false
+/// if they run past the end of the input, so they are decoded to fail in the usual place.
+static bool skip_struct_ref(Struct &type, vector<int> &dimensions, InterpreterContext &context) {
+    auto size = static_cast<uint64_t>(type.m_fixed_size);
+    for (int dimension : dimensions) {
+        auto count = static_cast<uint64_t>(dimension);
+        if (count != 0 && size > context.input().remaining() / count)
+            return false;
+        size *= count;
     }
-    return array;
+    if (size > context.input().remaining())
+        return false;
+    // decoding nothing wouldn't move on to the next whole byte after bit fields either
+    if (size != 0)
+        context.input().seek(context.input().offset() + size);
+    return true;
 }
 
 void StructRefStatement::execute(InterpreterContext &context) {
     Struct &type = m_type->resolve(context);
 
     for (upVarDecl &decl : m_values) {
-        if (decl->m_dimensions.empty()) {
-            spStructRuntimeValue struct_ref = context.begin_struct_ref(decl->m_name, m_modifiers);
-            context.execute_struct(type, struct_ref);
-            context.end_struct_ref();
-            context.define_struct_ref(decl->m_name) = struct_ref;
+        vector<int> dimensions = evaluate_dimensions(decl->m_dimensions, context);
+
+        if (m_skippable && type.m_fixed_size >= 0 && !context.is_struct_ref_output(decl->m_name, m_modifiers)
+                && skip_struct_ref(type, dimensions, context))
+            continue;
+
+        if (dimensions.empty()) {
+            spStructRuntimeValue struct_ref = context.begin_struct_ref(decl->m_name, type, m_modifiers);
+            spRuntimeValue value = context.execute_struct(type, struct_ref);
+            context.end_struct_ref(value);
+            // the name is still defined, so redeclaring it is an error whether or not the value is kept
+            context.define_struct_ref(decl->m_name) = m_skippable ? nullptr : value;
         } else {
-
-            vector<int> dimensions(decl->m_dimensions.size());
-            for (int i = 0; i < dimensions.size(); i++) {
-                spRuntimeValue dim = context.evaluate_expression(*decl->m_dimensions[i]);
-                if (dim->m_type != RuntimeType::INT) throw "Array dimension must be an integer, not " + dim->to_string();
-                int32_t dim_val = dynamic_cast<IntegerRuntimeValue&>(*dim).m_value;
-                if (dim_val < 0) throw "Negative array size " + dim->to_string();
-                if (dim_val >= numeric_limits<int>::max()) throw "Array size too large " + dim->to_string();
-                dimensions[i] = dim_val;
+            if (dimensions.size() == 1 && is_byte_type(type)) {
+                spRuntimeValue bytes = define_struct_ref_bytes(type, decl->m_name, m_modifiers, dimensions[0], context);
+                context.define_struct_ref(decl->m_name) = m_skippable ? nullptr : bytes;
+                continue;
             }
 
-            vector<int> indices(dimensions.size());
-
-            spRuntimeValue struct_ref = define_struct_ref_array(type, decl->m_name, m_modifiers, dimensions, 0, indices, context);
+            spRuntimeValue struct_ref = define_struct_ref_array(type, decl->m_name, m_modifiers, dimensions, !m_skippable, context);
             context.define_struct_ref(decl->m_name) = struct_ref;
         }
     }
@@ -189,11 +323,19 @@ spRuntimeValue VarReferenceExpression::evaluate(InterpreterContext &context) {
 
 spRuntimeValue BinaryOperatorExpression::evaluate(InterpreterContext &context) {
     spRuntimeValue lhs = context.evaluate_expression(*m_left);
+    if (m_typed.apply) {
+        spRuntimeValue rhs = context.evaluate_expression(*m_right);
+        if (lhs->m_type == m_typed.left && rhs->m_type == m_typed.right)
+            return m_typed.apply(*lhs, *rhs);
+        return m_typed.generic(*lhs, *rhs);
+    }
     return m_operator(*lhs, *m_right, context);
 }
 
 spRuntimeValue UnaryOperatorExpression::evaluate(InterpreterContext &context) {
     spRuntimeValue value = context.evaluate_expression(*m_expr);
+    if (m_typed.apply && value->m_type == m_typed.operand)
+        return m_typed.apply(*value);
     return m_operator(*value);
 }
 
@@ -209,40 +351,224 @@ spRuntimeValue FieldAccessExpression::evaluate(InterpreterContext &context) {
 }
 
 spRuntimeValue PreIncrementExpression::evaluate(InterpreterContext &context) {
-    spRuntimeValue &var_handle = context.resolve_variable(m_var);
+    spRuntimeValue &var_handle = context.assign_variable(m_var);
     if (var_handle == nullptr)
         throw "Reference to undefined variable " + m_var;
+    // Nothing else can see the change to a value only the variable holds. Literals and constants are always held by
+    // their expression too, so they are never changed.
+    if (var_handle.use_count() == 1 && increment_in_place(*var_handle, m_delta))
+        return var_handle;
     IntegerRuntimeValue delta(m_delta);
     var_handle = *var_handle + delta;
     return var_handle;
 }
 
 spRuntimeValue PostIncrementExpression::evaluate(InterpreterContext &context) {
-    spRuntimeValue &var_handle = context.resolve_variable(m_var);
+    spRuntimeValue &var_handle = context.assign_variable(m_var);
     if (var_handle == nullptr)
         throw "Reference to undefined variable" + m_var;
+    // values are only changed in place while nothing else holds them, so the old one can be returned as it is
     IntegerRuntimeValue delta(m_delta);
-    spRuntimeValue temp = *var_handle + delta;
-    spRuntimeValue ret = var_handle->copy();
-    var_handle = temp;
+    spRuntimeValue ret = var_handle;
+    var_handle = *var_handle + delta;
     return ret;
 }
 
 spRuntimeValue BuiltinFunctionExpression::evaluate(InterpreterContext &context) {
-    vector<RuntimeValue*> args(m_args.size());
-    for (int i = 0; i < m_args.size(); i++)
-        args[i] = &*context.evaluate_expression(*m_args[i]);
+    spRuntimeValue args[MAX_BUILTIN_ARGS];
+    size_t arg_count = m_args.size();
+    for (size_t i = 0; i < arg_count; i++)
+        args[i] = context.evaluate_expression(*m_args[i]);
 
-    return context.evaluate_builtin_function(m_name, args);
+    return m_function->function(context, args, arg_count);
+}
+
+/// Enum and flags members are constants named after the enum, e.g. cp_type::CONSTANT_Class. Members of anonymous
+/// enums are just named after the member.
+static void define_enum_constants(Struct &type, InterpreterContext &context) {
+    for (upStatement &statement : type.m_body) {
+        auto member = dynamic_cast<AssignmentStatement*>(&*statement);
+        if (!member || !member->m_is_assign_only)
+            throw "Enum and flags members must be of the form name = value";
+        string name = type.m_name ? *type.m_name + "::" + member->m_name : member->m_name;
+        context.define_constant(name) = context.evaluate_expression(*member->m_value);
+    }
+}
+
+static void define_compiled_enum_constants(Struct &type, EnumNames &names, InterpreterContext &context) {
+    if (names.m_global) {
+        if (context.mark_enum_defined(&type)) {
+            for (pair<string, spRuntimeValue> &member : names.m_members)
+                context.define_global_constant(*type.m_name + "::" + member.first) = member.second;
+        }
+        return;
+    }
+    for (pair<string, spRuntimeValue> &member : names.m_members) {
+        string name = type.m_name ? *type.m_name + "::" + member.first : member.first;
+        context.define_constant(name) = member.second;
+    }
 }
 
 Struct& DeclaringStructRef::resolve(InterpreterContext &context) {
     if (m_declaration->m_name) {
         context.declare_struct(*m_declaration->m_name) = &*m_declaration;
     }
+    if (m_declaration->m_type == StructType::ENUM || m_declaration->m_type == StructType::FLAGS) {
+        if (m_declaration->m_enum_names)
+            define_compiled_enum_constants(*m_declaration, *m_declaration->m_enum_names, context);
+        else
+            define_enum_constants(*m_declaration, context);
+    }
     return *m_declaration;
 }
 
+const string *EnumNames::find_name(int64_t value) {
+    if (!m_dense_names.empty()) {
+        auto offset = static_cast<uint64_t>(value) - static_cast<uint64_t>(m_min);
+        return offset < m_dense_names.size() ? m_dense_names[offset] : nullptr;
+    }
+    auto itr = lower_bound(m_sparse_names.begin(), m_sparse_names.end(), value,
+            [](const pair<int64_t, const string*> &entry, int64_t value) { return entry.first < value; });
+    if (itr != m_sparse_names.end() && itr->first == value)
+        return itr->second;
+    return nullptr;
+}
+
+void EnumNames::append_enum(string &out, int64_t value) {
+    const string *name = find_name(value);
+    if (name) {
+        out += *name;
+        out += " (";
+        append_int(out, value);
+        out += ')';
+    } else {
+        append_int(out, value);
+    }
+}
+
+void EnumNames::append_flags(string &out, uint64_t value) {
+    uint64_t remaining = value;
+    bool first = true;
+    for (pair<uint64_t, const string*> &mask : m_mask_names) {
+        if ((value & mask.first) == mask.first) {
+            if (!first)
+                out += " | ";
+            out += *mask.second;
+            first = false;
+            remaining &= ~mask.first;
+        }
+    }
+    // one iteration per set bit
+    uint64_t unnamed = 0;
+    for (uint64_t bits = remaining; bits != 0; bits &= bits - 1) {
+        int bit = __builtin_ctzll(bits);
+        if (m_bit_names[bit]) {
+            if (!first)
+                out += " | ";
+            out += *m_bit_names[bit];
+            first = false;
+        } else {
+            unnamed |= uint64_t(1) << bit;
+        }
+    }
+    if (unnamed != 0) {
+        if (!first)
+            out += " | ";
+        out += "0x";
+        append_hex(out, unnamed);
+        first = false;
+    }
+    if (!first)
+        out += ' ';
+    out += "(0x";
+    append_hex(out, value);
+    out += ')';
+}
+
 Struct& ResolvingStructRef::resolve(InterpreterContext &context) {
     return context.resolve_struct(m_name);
 }
+
+
+void BlockStatement::for_each_child(const function<void(Statement&)> &on_statement, const function<void(Expression&)> &/*on_expression*/) {
+    for (upStatement &statement : m_statements)
+        on_statement(*statement);
+}
+
+void IfStatement::for_each_child(const function<void(Statement&)> &on_statement, const function<void(Expression&)> &on_expression) {
+    on_expression(*m_condition);
+    on_statement(*m_if_true);
+    if (m_if_false)
+        on_statement(*m_if_false);
+}
+
+void WhileStatement::for_each_child(const function<void(Statement&)> &on_statement, const function<void(Expression&)> &on_expression) {
+    on_expression(*m_condition);
+    on_statement(*m_body);
+}
+
+void DeflateStatement::for_each_child(const function<void(Statement&)> &on_statement, const function<void(Expression&)> &on_expression) {
+    on_expression(*m_length);
+    on_statement(*m_body);
+}
+
+void DoWhileStatement::for_each_child(const function<void(Statement&)> &on_statement, const function<void(Expression&)> &on_expression) {
+    on_statement(*m_body);
+    on_expression(*m_condition);
+}
+
+void SwitchStatement::for_each_child(const function<void(Statement&)> &on_statement, const function<void(Expression&)> &on_expression) {
+    on_expression(*m_value);
+    for (pair<upExpression, int> &case_label : m_case_labels)
+        on_expression(*case_label.first);
+    for (upStatement &statement : m_statements)
+        on_statement(*statement);
+}
+
+void VarDeclStatement::for_each_child(const function<void(Statement&)> &/*on_statement*/, const function<void(Expression&)> &on_expression) {
+    for (pair<upVarDecl, upExpression> &decl : m_declarations) {
+        for (upExpression &dimension : decl.first->m_dimensions)
+            on_expression(*dimension);
+        if (decl.second)
+            on_expression(*decl.second);
+    }
+}
+
+void AssignmentStatement::for_each_child(const function<void(Statement&)> &/*on_statement*/, const function<void(Expression&)> &on_expression) {
+    on_expression(*m_value);
+}
+
+void BuiltinFunctionStatement::for_each_child(const function<void(Statement&)> &/*on_statement*/, const function<void(Expression&)> &on_expression) {
+    for (upExpression &arg : m_args)
+        on_expression(*arg);
+}
+
+void StructRefStatement::for_each_child(const function<void(Statement&)> &on_statement, const function<void(Expression&)> &on_expression) {
+    // the body of a struct declared here
+    if (auto declaring = dynamic_cast<DeclaringStructRef*>(&*m_type)) {
+        for (upStatement &statement : declaring->m_declaration->m_body)
+            on_statement(*statement);
+    }
+    for (upVarDecl &decl : m_values) {
+        for (upExpression &dimension : decl->m_dimensions)
+            on_expression(*dimension);
+    }
+}
+
+void BinaryOperatorExpression::for_each_child(const function<void(Expression&)> &on_expression) {
+    on_expression(*m_left);
+    on_expression(*m_right);
+}
+
+void UnaryOperatorExpression::for_each_child(const function<void(Expression&)> &on_expression) {
+    on_expression(*m_expr);
+}
+
+void FieldAccessExpression::for_each_child(const function<void(Expression&)> &on_expression) {
+    on_expression(*m_struct);
+}
+
+void BuiltinFunctionExpression::for_each_child(const function<void(Expression&)> &on_expression) {
+    for (upExpression &arg : m_args)
+        on_expression(*arg);
+}
@@ -2,15 +2,20 @@
 #ifndef DECODE_BIN_AST_H
 #define DECODE_BIN_AST_H
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <utility>
 #include <vector>
+#include "builtins.h"
 #include "interpreter.h"
 #include "tokenizer.h"
 
 enum class StructType {
-    STRUCT, ENUM, FLAGS, UNION, CHOOSE
+    STRUCT, ENUM, FLAGS, UNION, CHOOSE, PRIMITIVE
+};
+enum class PrimitiveType {
+    U1, U2, U4, U8, S1, S2, S4, S8, F4, F8, BITS, ULEB128, SLEB128, VARINT, ZIGZAG
 };
 enum class StructModifierType {
     ARRAY_VALUE, ELEMENT_TYPE
@@ -27,6 +32,8 @@ public:
     explicit Statement(Token begin_token) : m_begin_token(std::move(begin_token)) {}
 
     virtual void execute(InterpreterContext &context) = 0;
+    // used by passes over the whole tree, see compiler.h
+    virtual void for_each_child(const std::function<void(Statement&)> &/*on_statement*/, const std::function<void(Expression&)> &/*on_expression*/) {}
 };
 typedef std::unique_ptr<Statement> upStatement;
 
@@ -38,6 +45,7 @@ public:
     explicit Expression(Token begin_token) : m_begin_token(std::move(begin_token)) {}
 
     virtual spRuntimeValue evaluate(InterpreterContext &context) = 0;
+    virtual void for_each_child(const std::function<void(Expression&)> &/*on_expression*/) {}
 };
 typedef std::unique_ptr<Expression> upExpression;
 
@@ -54,6 +62,7 @@ public:
 
     std::vector<upStatement> m_statements;
     void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
 };
 
 class IfStatement : public Statement {
@@ -64,6 +73,7 @@ public:
     upStatement m_if_true;
     upStatement m_if_false;
     void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
 };
 
 class WhileStatement : public Statement {
@@ -73,6 +83,7 @@ public:
     upExpression m_condition;
     upStatement m_body;
     void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
 };
 
 class DoWhileStatement : public Statement {
@@ -82,6 +93,7 @@ public:
     upStatement m_body;
     upExpression m_condition;
     void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
 };
 
 class SwitchStatement : public Statement {
@@ -92,7 +104,30 @@ public:
     std::vector<upStatement> m_statements;
     std::vector<std::pair<upExpression, int>> m_case_labels;
     int m_default_label;
+
+    // Filled in by compile() if every case label is a constant. Dense tables are indexed by value - m_jump_table_min
+    // and hold -1 where there is no case, sparse tables are sorted by value.
+    bool m_has_jump_table = false;
+    int64_t m_jump_table_min = 0;
+    std::vector<int> m_dense_jump_table;
+    std::vector<std::pair<int64_t, int>> m_sparse_jump_table;
+
+    // false if the value can't be looked up in a jump table
+    static bool to_jump_table_key(RuntimeValue &value, int64_t &key);
+    void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
+};
+
+/// deflate (length) statement: decodes the statement from the raw deflate data in the next length bytes, inflated,
+/// and then carries on after them
+class DeflateStatement : public Statement {
+public:
+    explicit DeflateStatement(Token begin_token) : Statement(std::move(begin_token)) {}
+
+    upExpression m_length;
+    upStatement m_body;
     void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
 };
 
 class BreakStatement : public Statement {
@@ -122,6 +157,7 @@ public:
     
     std::vector<std::pair<upVarDecl, upExpression>> m_declarations;
     void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
 };
 
 class AssignmentStatement : public Statement {
@@ -129,10 +165,15 @@ public:
     explicit AssignmentStatement(Token begin_token) : Statement(std::move(begin_token)) {}
     
     std::string m_name;
+    // the operator token, e.g. "+="
+    std::string m_op;
     AssignmentOperator m_operator;
+    // used instead of m_operator when the variable's value is only held by the variable, nullptr if it can't be
+    InPlaceOperator m_in_place = nullptr;
     upExpression m_value;
     bool m_is_assign_only;
     void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
 };
 
 class BuiltinFunctionStatement : public Statement {
@@ -140,8 +181,11 @@ public:
     explicit BuiltinFunctionStatement(Token begin_token) : Statement(std::move(begin_token)) {}
     
     std::string m_name;
+    // resolved by the parser
+    const BuiltinFunction *m_function;
     std::vector<upExpression> m_args;
     void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
 };
 
 class Struct;
@@ -164,12 +208,56 @@ public:
     Struct& resolve(InterpreterContext &context) override;
 };
 
+/// Built by compile() for enums and flags whose members are all constants, so that the members don't need to be
+/// evaluated each time the declaration is executed and values can be named quickly.
+class EnumNames {
+public:
+    // in declaration order, names are unqualified
+    std::vector<std::pair<std::string, spRuntimeValue>> m_members;
+    // true if the qualified names are unambiguous and so can be defined once for the whole program
+    bool m_global = false;
+
+    // Enums: value to member name. Dense tables are indexed by value - m_min and hold nullptr where there is no
+    // member, sparse tables are sorted by value.
+    int64_t m_min = 0;
+    std::vector<const std::string*> m_dense_names;
+    std::vector<std::pair<int64_t, const std::string*>> m_sparse_names;
+
+    // Flags: members which are a single bit are looked up by bit index, others are tested as masks
+    const std::string *m_bit_names[64] = {};
+    std::vector<std::pair<uint64_t, const std::string*>> m_mask_names;
+
+    // returns nullptr if no member has this value
+    const std::string *find_name(int64_t value);
+    // e.g. "CONSTANT_Utf8 (1)"
+    void append_enum(std::string &out, int64_t value);
+    // e.g. "acc_public | acc_super (0x21)"
+    void append_flags(std::string &out, uint64_t value);
+};
+
 class Struct {
 public:
+    // not set for builtin structs
+    Token m_begin_token = {"", 0, 0};
+    Token m_end_token = {"", 0, 0};
     StructType m_type;
+    // only for StructType::PRIMITIVE, these have no body
+    PrimitiveType m_primitive_type;
+    // only for PrimitiveType::BITS, how many bits it reads
+    int m_bit_width = 0;
     std::map<StructModifierType, std::shared_ptr<void>> m_modifiers;
     std::unique_ptr<std::string> m_name;
     std::vector<upStatement> m_body;
+    // only for enums and flags, nullptr if the members aren't all constant
+    std::unique_ptr<EnumNames> m_enum_names;
+    // the number of bytes it always decodes from, or -1 if that depends on the input. Filled in by compile(), except
+    // for primitives which are always known.
+    int64_t m_fixed_size = -1;
+    // Filled in by compile(). Decoding a closed struct depends only on the input, where it starts and the byte order,
+    // not on any variables of the structs it's used in.
+    bool m_closed = false;
+    // only for choose, filled in by compile(), whether each statement in the body is closed in the same sense
+    std::vector<bool> m_closed_alternatives;
 };
 
 class StructRefStatement : public Statement {
@@ -179,7 +267,12 @@ public:
     upStructRef m_type;
     std::map<StructRefModifierType, std::shared_ptr<void>> m_modifiers;
     std::vector<upVarDecl> m_values;
+    // Filled in by compile(), true if nothing in the program reads these values back. They can then be skipped
+    // without decoding when their type has a fixed size and they wouldn't be output, and otherwise are released as
+    // soon as they have been output rather than kept until the end.
+    bool m_skippable = false;
     void execute(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Statement&)> &on_statement, const std::function<void(Expression&)> &on_expression) override;
 };
 
 
@@ -205,8 +298,14 @@ public:
     
     upExpression m_left;
     upExpression m_right;
+    // the operator token, "[]" for indexing
+    std::string m_op;
     BinaryOperator m_operator;
+    // Filled in by compile() when it can work out the types of both operands. Names are resolved as the program
+    // runs, so the types are checked each time and m_typed.generic is used for operands of other types.
+    TypedBinaryOperator m_typed = {};
     spRuntimeValue evaluate(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Expression&)> &on_expression) override;
 };
 
 class UnaryOperatorExpression : public Expression {
@@ -214,8 +313,12 @@ public:
     explicit UnaryOperatorExpression(Token begin_token) : Expression(std::move(begin_token)) {}
     
     upExpression m_expr;
+    std::string m_op;
     UnaryOperator m_operator;
+    // as for BinaryOperatorExpression
+    TypedUnaryOperator m_typed = {};
     spRuntimeValue evaluate(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Expression&)> &on_expression) override;
 };
 
 class FieldAccessExpression : public Expression {
@@ -225,6 +328,7 @@ public:
     upExpression m_struct;
     std::string m_field;
     spRuntimeValue evaluate(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Expression&)> &on_expression) override;
 };
 
 class PreIncrementExpression : public Expression {
@@ -250,8 +354,11 @@ public:
     explicit BuiltinFunctionExpression(Token begin_token) : Expression(std::move(begin_token)) {}
     
     std::string m_name;
+    // resolved by the parser
+    const BuiltinFunction *m_function;
     std::vector<upExpression> m_args;
     spRuntimeValue evaluate(InterpreterContext &context) override;
+    void for_each_child(const std::function<void(Expression&)> &on_expression) override;
 };
 
 #endif //DECODE_BIN_AST_H
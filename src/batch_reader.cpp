@@ -0,0 +1,98 @@
+
+#include "batch_reader.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+BatchReader::BatchReader(vector<string> paths, unsigned queue_depth)
+        : m_paths(move(paths)), m_queue_depth(max(1u, queue_depth)) {
+    m_stats.queue_depth = m_queue_depth;
+}
+
+bool list_directory_files(const string &dir, vector<string> &names) {
+    DIR *handle = opendir(dir.c_str());
+    if (!handle)
+        return false;
+    while (dirent *entry = readdir(handle)) {
+        if (entry->d_name[0] == '.')
+            continue;
+        bool is_directory = entry->d_type == DT_DIR;
+        struct stat status;
+        if (entry->d_type == DT_UNKNOWN && stat((dir + "/" + entry->d_name).c_str(), &status) == 0)
+            is_directory = S_ISDIR(status.st_mode);
+        if (!is_directory)
+            names.emplace_back(entry->d_name);
+    }
+    closedir(handle);
+    sort(names.begin(), names.end());
+    return true;
+}
+
+static string read_error(const string &path, int error) {
+    return "Failed to read " + path + ": " + strerror(error);
+}
+
+void BatchReader::read_all(const OnFile &on_file) {
+    atomic<size_t> next(0);
+    atomic<uint64_t> syscalls(0), bytes(0);
+    mutex on_file_mutex;
+    auto worker = [&]() {
+        for (size_t i = next++; i < m_paths.size(); i = next++) {
+            spInputData data;
+            string error;
+            int fd = open(m_paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+            syscalls++;
+            struct stat status;
+            if (fd < 0) {
+                error = read_error(m_paths[i], errno);
+            } else if (syscalls++, fstat(fd, &status) != 0) {
+                error = read_error(m_paths[i], errno);
+            } else {
+                data = make_shared<vector<uint8_t>>(static_cast<size_t>(status.st_size));
+                size_t done = 0;
+                while (done < data->size()) {
+                    ssize_t count = pread(fd, data->data() + done, data->size() - done, static_cast<off_t>(done));
+                    syscalls++;
+                    if (count < 0 && errno == EINTR)
+                        continue;
+                    if (count < 0) {
+                        error = read_error(m_paths[i], errno);
+                        data = nullptr;
+                        break;
+                    }
+                    if (count == 0) {
+                        // it got shorter
+                        data->resize(done);
+                        break;
+                    }
+                    done += static_cast<size_t>(count);
+                }
+            }
+            if (fd >= 0) {
+                close(fd);
+                syscalls++;
+            }
+            if (data)
+                bytes += data->size();
+            lock_guard<mutex> lock(on_file_mutex);
+            on_file(i, move(data), error);
+        }
+    };
+    vector<thread> threads;
+    for (unsigned i = 0; i < m_queue_depth && i < m_paths.size(); i++)
+        threads.emplace_back(worker);
+    for (thread &t : threads)
+        t.join();
+    m_stats.syscalls = syscalls;
+    m_stats.files = m_paths.size();
+    m_stats.bytes = bytes;
+}
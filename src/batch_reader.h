@@ -0,0 +1,44 @@
+
+#ifndef DECODE_BIN_BATCH_READER_H
+#define DECODE_BIN_BATCH_READER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "input.h"
+
+/// How BatchReader read the files
+struct BatchReaderStats {
+    // threads reading a file each at once at most, as asked for
+    unsigned queue_depth = 0;
+    // system calls made by reading, not counting setting up
+    uint64_t syscalls = 0;
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+};
+
+/// Reads many whole files, for decoding batches of small files, where opening, reading and closing each in turn
+/// would cost more than decoding it. queue_depth threads each read one file at a time, so while some wait for the
+/// disk others have their data.
+class BatchReader {
+    std::vector<std::string> m_paths;
+    unsigned m_queue_depth;
+public:
+    // Called from a reading thread as each file is read, in whatever order they finish. data is nullptr and error
+    // says why if the file couldn't be read. Readers wait while it runs, so it can wait for the files to be used up.
+    typedef std::function<void(size_t index, spInputData data, const std::string &error)> OnFile;
+
+    BatchReaderStats m_stats;
+
+    BatchReader(std::vector<std::string> paths, unsigned queue_depth);
+
+    // returns once every file has been passed to on_file
+    void read_all(const OnFile &on_file);
+};
+
+// The names of the files in a directory, sorted, leaving out subdirectories and names starting with a dot. Returns
+// false if it can't be read.
+bool list_directory_files(const std::string &dir, std::vector<std::string> &names);
+
+#endif //DECODE_BIN_BATCH_READER_H
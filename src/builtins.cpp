@@ -0,0 +1,126 @@
+
+#include "builtins.h"
+#include "utf8.h"
+
+using namespace std;
+
+static int32_t int_arg(const char *name, spRuntimeValue &arg) {
+    if (arg->m_type != RuntimeType::INT)
+        throw "Expected an integer argument to " + string(name) + ", not " + arg->to_string();
+    return dynamic_cast<IntegerRuntimeValue&>(*arg).m_value;
+}
+
+/// print(value[, end]), end defaults to a newline
+static spRuntimeValue builtin_print(InterpreterContext &context, spRuntimeValue *args, size_t arg_count) {
+    string text;
+    args[0]->append_to(text);
+    if (arg_count == 2)
+        args[1]->append_to(text);
+    else
+        text += '\n';
+    context.write_output(text);
+    return nullptr;
+}
+
+/// assert(condition[, message])
+static spRuntimeValue builtin_assert(InterpreterContext &context, spRuntimeValue *args, size_t arg_count) {
+    if (!args[0]->to_boolean())
+        context.fail(DecodeFailure::assertion(context.input().offset(), arg_count == 2 ? args[1] : nullptr));
+    return nullptr;
+}
+
+/// byte_order(std::little_endian or std::big_endian)
+static spRuntimeValue builtin_byte_order(InterpreterContext &context, spRuntimeValue *args, size_t /*arg_count*/) {
+    int32_t byte_order = int_arg("byte_order", args[0]);
+    if (byte_order == 0)
+        context.set_byte_order(ByteOrder::LITTLE);
+    else if (byte_order == 1)
+        context.set_byte_order(ByteOrder::BIG);
+    else
+        throw "Invalid byte order " + args[0]->to_string();
+    return nullptr;
+}
+
+/// align([alignment]), skips the rest of a byte partly read by bit fields, and then to a multiple of alignment bytes
+/// from the start of the input
+static spRuntimeValue builtin_align(InterpreterContext &context, spRuntimeValue *args, size_t arg_count) {
+    int32_t alignment = arg_count == 1 ? int_arg("align", args[0]) : 1;
+    if (alignment <= 0)
+        throw "Invalid alignment " + args[0]->to_string();
+    Input &input = context.input();
+    size_t offset = input.offset();
+    size_t padding = (alignment - offset % alignment) % alignment;
+    if (context.check_remaining(padding))
+        input.seek(offset + padding);
+    return nullptr;
+}
+
+/// char(code_point), a string containing that one character
+static spRuntimeValue builtin_char(InterpreterContext &/*context*/, spRuntimeValue *args, size_t /*arg_count*/) {
+    auto ret = make_shared<StringRuntimeValue>(string());
+    int32_t code_point = int_arg("char", args[0]);
+    if (code_point < 0 || !append_utf8(ret->m_value, static_cast<uint32_t>(code_point)))
+        throw "Invalid code point " + args[0]->to_string();
+    return ret;
+}
+
+static spRuntimeValue decode_string(const char *name, spRuntimeValue *args, size_t arg_count, bool modified) {
+    const uint8_t *data;
+    size_t length;
+    vector<uint8_t> gathered;
+    if (args[0]->m_type == RuntimeType::BYTES) {
+        auto &bytes = dynamic_cast<BytesRuntimeValue&>(*args[0]);
+        data = bytes.bytes();
+        length = bytes.m_length;
+    } else if (args[0]->m_type == RuntimeType::ARRAY) {
+        // slow path for arrays that weren't decoded as bytes
+        for (spRuntimeValue &element : *dynamic_cast<ArrayRuntimeValue&>(*args[0]).m_values) {
+            if (!element)
+                throw "Reference to uninitialized array value";
+            gathered.push_back(static_cast<uint8_t>(int_arg(name, element)));
+        }
+        data = gathered.data();
+        length = gathered.size();
+    } else {
+        throw string(name) + " expects an array of bytes, not " + args[0]->to_string();
+    }
+    if (arg_count == 2) {
+        int32_t requested_length = int_arg(name, args[1]);
+        if (requested_length < 0 || static_cast<size_t>(requested_length) > length)
+            throw "Length " + args[1]->to_string() + " is out of bounds for " + name;
+        length = static_cast<size_t>(requested_length);
+    }
+
+    auto ret = make_shared<StringRuntimeValue>(string());
+    if (!(modified ? decode_modified_utf8(data, length, ret->m_value) : decode_utf8(data, length, ret->m_value)))
+        throw string(modified ? "Malformed modified UTF-8 string" : "Malformed UTF-8 string");
+    return ret;
+}
+
+/// utf8(bytes[, length])
+static spRuntimeValue builtin_utf8(InterpreterContext &/*context*/, spRuntimeValue *args, size_t arg_count) {
+    return decode_string("utf8", args, arg_count, false);
+}
+
+/// mutf8(bytes[, length])
+static spRuntimeValue builtin_mutf8(InterpreterContext &/*context*/, spRuntimeValue *args, size_t arg_count) {
+    return decode_string("mutf8", args, arg_count, true);
+}
+
+static const BuiltinFunction BUILTIN_FUNCTIONS[] = {
+        {"print", 1, 2, false, builtin_print},
+        {"assert", 1, 2, false, builtin_assert},
+        {"byte_order", 1, 1, false, builtin_byte_order},
+        {"align", 0, 1, false, builtin_align},
+        {"char", 1, 1, true, builtin_char},
+        {"utf8", 1, 2, true, builtin_utf8},
+        {"mutf8", 1, 2, true, builtin_mutf8},
+};
+
+const BuiltinFunction *find_builtin_function(const string &name) {
+    for (const BuiltinFunction &function : BUILTIN_FUNCTIONS) {
+        if (name == function.name)
+            return &function;
+    }
+    return nullptr;
+}
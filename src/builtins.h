@@ -0,0 +1,26 @@
+
+#ifndef DECODE_BIN_BUILTINS_H
+#define DECODE_BIN_BUILTINS_H
+
+#include <cstddef>
+#include <string>
+#include "interpreter.h"
+
+const size_t MAX_BUILTIN_ARGS = 4;
+
+// args points to arg_count evaluated arguments, which have already been checked against the function's arity
+typedef spRuntimeValue (*BuiltinFunctionPtr)(InterpreterContext &context, spRuntimeValue *args, size_t arg_count);
+
+struct BuiltinFunction {
+    const char *name;
+    size_t min_args;
+    size_t max_args;
+    // false for functions which can only be called as statements
+    bool returns_value;
+    BuiltinFunctionPtr function;
+};
+
+// returns nullptr if there is no builtin function with that name
+const BuiltinFunction *find_builtin_function(const std::string &name);
+
+#endif //DECODE_BIN_BUILTINS_H
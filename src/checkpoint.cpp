@@ -0,0 +1,189 @@
+
+#include "checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include "ast.h"
+
+using namespace std;
+
+// marks an array element which was never decoded
+const uint8_t NULL_VALUE = 0xff;
+
+void CheckpointWriter::write_u64(uint64_t value) {
+    for (int i = 0; i < 8; i++)
+        write_u8(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void CheckpointWriter::write_string(const string &value) {
+    write_u64(value.length());
+    m_data += value;
+}
+
+void CheckpointWriter::write_value(RuntimeValue *value) {
+    if (!value) {
+        write_u8(NULL_VALUE);
+        return;
+    }
+    write_u8(static_cast<uint8_t>(value->m_type));
+    switch (value->m_type) {
+        case RuntimeType::INT:
+            write_u64(static_cast<uint32_t>(static_cast<IntegerRuntimeValue*>(value)->m_value));
+            break;
+        case RuntimeType::LONG:
+            write_u64(static_cast<uint64_t>(static_cast<LongRuntimeValue*>(value)->m_value));
+            break;
+        case RuntimeType::FLOAT: {
+            uint32_t bits;
+            memcpy(&bits, &static_cast<FloatRuntimeValue*>(value)->m_value, sizeof(bits));
+            write_u64(bits);
+            break;
+        }
+        case RuntimeType::DOUBLE: {
+            uint64_t bits;
+            memcpy(&bits, &static_cast<DoubleRuntimeValue*>(value)->m_value, sizeof(bits));
+            write_u64(bits);
+            break;
+        }
+        case RuntimeType::BOOLEAN:
+            write_u8(static_cast<BooleanRuntimeValue*>(value)->m_value);
+            break;
+        case RuntimeType::STRING:
+            write_string(static_cast<StringRuntimeValue*>(value)->m_value);
+            break;
+        case RuntimeType::BYTES: {
+            auto bytes = static_cast<BytesRuntimeValue*>(value);
+            write_u8(bytes->m_signed);
+            bool in_input = bytes->m_data == m_input;
+            write_u8(in_input);
+            if (in_input) {
+                write_u64(bytes->m_offset);
+                write_u64(bytes->m_length);
+            } else {
+                write_string(string(reinterpret_cast<const char*>(bytes->bytes()), bytes->m_length));
+            }
+            break;
+        }
+        case RuntimeType::ARRAY: {
+            auto &elements = *static_cast<ArrayRuntimeValue*>(value)->m_values;
+            write_u64(elements.size());
+            for (spRuntimeValue &element : elements)
+                write_value(element.get());
+            break;
+        }
+        case RuntimeType::STRUCT: {
+            auto &fields = *static_cast<StructRuntimeValue*>(value)->m_values;
+            write_u64(fields.size());
+            for (auto &field : fields) {
+                write_string(field.first);
+                write_value(field.second.get());
+            }
+            break;
+        }
+    }
+}
+
+bool CheckpointWriter::save(const string &filename) {
+    string temporary = filename + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(m_data.data(), 1, m_data.size(), file) == m_data.size();
+    ok = fclose(file) == 0 && ok;
+    return ok && rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+uint8_t CheckpointReader::read_u8() {
+    if (m_offset >= m_data.size())
+        throw "Checkpoint is truncated";
+    return m_data[m_offset++];
+}
+
+uint64_t CheckpointReader::read_u64() {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value |= static_cast<uint64_t>(read_u8()) << (8 * i);
+    return value;
+}
+
+string CheckpointReader::read_string() {
+    uint64_t length = read_u64();
+    if (length > m_data.size() - m_offset)
+        throw "Checkpoint is truncated";
+    string value(reinterpret_cast<const char*>(m_data.data()) + m_offset, length);
+    m_offset += length;
+    return value;
+}
+
+spRuntimeValue CheckpointReader::read_value(spInputData &input) {
+    uint8_t type = read_u8();
+    if (type == NULL_VALUE)
+        return nullptr;
+    switch (static_cast<RuntimeType>(type)) {
+        case RuntimeType::INT:
+            return make_shared<IntegerRuntimeValue>(static_cast<int32_t>(static_cast<uint32_t>(read_u64())));
+        case RuntimeType::LONG:
+            return make_shared<LongRuntimeValue>(static_cast<int64_t>(read_u64()));
+        case RuntimeType::FLOAT: {
+            auto bits = static_cast<uint32_t>(read_u64());
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return make_shared<FloatRuntimeValue>(value);
+        }
+        case RuntimeType::DOUBLE: {
+            uint64_t bits = read_u64();
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return make_shared<DoubleRuntimeValue>(value);
+        }
+        case RuntimeType::BOOLEAN:
+            return make_shared<BooleanRuntimeValue>(read_u8() != 0);
+        case RuntimeType::STRING:
+            return make_shared<StringRuntimeValue>(read_string());
+        case RuntimeType::BYTES: {
+            bool is_signed = read_u8() != 0;
+            if (!read_u8()) {
+                // e.g. inflated data, which isn't kept anywhere else
+                string contents = read_string();
+                auto data = make_shared<vector<uint8_t>>(contents.begin(), contents.end());
+                return make_shared<BytesRuntimeValue>(data, 0, data->size(), is_signed);
+            }
+            uint64_t offset = read_u64();
+            uint64_t length = read_u64();
+            if (offset > input->size() || length > input->size() - offset)
+                throw "Checkpoint refers to more input than there is";
+            return make_shared<BytesRuntimeValue>(input, offset, length, is_signed);
+        }
+        case RuntimeType::ARRAY: {
+            uint64_t count = read_u64();
+            auto elements = make_shared<vector<spRuntimeValue>>();
+            for (uint64_t i = 0; i < count; i++)
+                elements->push_back(read_value(input));
+            return make_shared<ArrayRuntimeValue>(move(elements));
+        }
+        case RuntimeType::STRUCT: {
+            uint64_t count = read_u64();
+            auto value = make_shared<StructRuntimeValue>();
+            for (uint64_t i = 0; i < count; i++) {
+                string name = read_string();
+                (*value->m_values)[name] = read_value(input);
+            }
+            return value;
+        }
+    }
+    throw "Checkpoint has a value of unknown type";
+}
+
+static void collect_declared_structs(Statement &statement, vector<Struct*> &structs) {
+    if (auto struct_ref = dynamic_cast<StructRefStatement*>(&statement)) {
+        if (auto declaring = dynamic_cast<DeclaringStructRef*>(&*struct_ref->m_type))
+            structs.push_back(&*declaring->m_declaration);
+    }
+    statement.for_each_child([&structs](Statement &child) { collect_declared_structs(child, structs); }, [](Expression&) {});
+}
+
+vector<Struct*> declared_structs(vector<upStatement> &statements) {
+    vector<Struct*> structs;
+    for (upStatement &statement : statements)
+        collect_declared_structs(*statement, structs);
+    return structs;
+}
@@ -0,0 +1,52 @@
+
+#ifndef DECODE_BIN_CHECKPOINT_H
+#define DECODE_BIN_CHECKPOINT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "input.h"
+
+struct RuntimeValue;
+class Struct;
+class Statement;
+
+/// Builds a checkpoint file, for --checkpoint-every. Everything is little endian, strings and counts are prefixed with
+/// their length.
+class CheckpointWriter {
+    std::string m_data;
+    // bytes values which view this are saved as where they are in it, others with their contents
+    spInputData m_input;
+public:
+    explicit CheckpointWriter(spInputData input) : m_input(std::move(input)) {}
+
+    void write_u8(uint8_t value) { m_data += static_cast<char>(value); }
+    void write_u64(uint64_t value);
+    void write_string(const std::string &value);
+    // values may be nullptr, e.g. array elements which were never decoded
+    void write_value(RuntimeValue *value);
+
+    // writes to a temporary file which is renamed over filename, so a crash never leaves half a checkpoint
+    bool save(const std::string &filename);
+};
+
+/// Reads a checkpoint file written by CheckpointWriter, throwing if it is cut short
+class CheckpointReader {
+    std::vector<uint8_t> m_data;
+    size_t m_offset = 0;
+public:
+    bool load(const std::string &filename) { return read_input_file(filename, m_data); }
+
+    uint8_t read_u8();
+    uint64_t read_u64();
+    std::string read_string();
+    // bytes values are views of the input, which has to be the same as when the checkpoint was written
+    std::shared_ptr<RuntimeValue> read_value(spInputData &input);
+};
+
+// Every struct declared in the program, in the same order for the same program, so that a checkpoint can refer to
+// them by index
+std::vector<Struct*> declared_structs(std::vector<std::unique_ptr<Statement>> &statements);
+
+#endif //DECODE_BIN_CHECKPOINT_H
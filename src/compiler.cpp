@@ -0,0 +1,848 @@
+
+#include "compiler.h"
+#include <algorithm>
+#include <map>
+#include <set>
+
+using namespace std;
+
+static void for_each_statement(Statement &statement, const function<void(Statement&)> &fn) {
+    fn(statement);
+    statement.for_each_child([&fn](Statement &child) { for_each_statement(child, fn); }, [](Expression&) {});
+}
+
+static void for_each_statement(vector<upStatement> &statements, const function<void(Statement&)> &fn) {
+    for (upStatement &statement : statements)
+        for_each_statement(*statement, fn);
+}
+
+/// Evaluates expressions in a context where only constants are defined: builtin variables such as std::big_endian,
+/// and members of named enums and flags, e.g. cp_type::CONSTANT_Utf8.
+class ConstantEvaluator {
+    InterpreterContext m_context;
+    set<string> m_ambiguous;
+public:
+    ConstantEvaluator() : m_context(Input()) {
+        m_context.push_scope();
+        declare_builtin_variables(m_context);
+        declare_builtin_structs(m_context);
+    }
+
+    // nullptr if the name isn't a builtin struct
+    Struct *builtin_struct(const string &name) {
+        try {
+            return &m_context.resolve_struct(name);
+        } catch (string &error) {
+            return nullptr;
+        }
+    }
+
+    bool evaluate(Expression &expression, spRuntimeValue &result) {
+        try {
+            result = m_context.evaluate_expression(expression);
+            return result != nullptr;
+        } catch (const char *error) {
+            m_context.clear_error_trace();
+            return false;
+        } catch (string &error) {
+            m_context.clear_error_trace();
+            return false;
+        }
+    }
+
+    // names defined differently in different places aren't constant
+    void define(const string &name, spRuntimeValue value) {
+        if (m_ambiguous.find(name) != m_ambiguous.end())
+            return;
+        spRuntimeValue &existing = m_context.define_constant(name);
+        if (existing && (existing->m_type != value->m_type || existing->to_string() != value->to_string())) {
+            m_ambiguous.insert(name);
+            existing = nullptr;
+            return;
+        }
+        existing = move(value);
+    }
+
+    bool is_ambiguous(const string &name) {
+        return m_ambiguous.find(name) != m_ambiguous.end();
+    }
+
+    void define_enum_constants(Struct &type) {
+        for (upStatement &statement : type.m_body) {
+            auto member = dynamic_cast<AssignmentStatement*>(&*statement);
+            if (!member || !member->m_is_assign_only)
+                continue;
+            spRuntimeValue value;
+            if (evaluate(*member->m_value, value))
+                define(*type.m_name + "::" + member->m_name, value);
+        }
+    }
+};
+
+static void collect_enums(vector<upStatement> &statements, ConstantEvaluator &constants, vector<Struct*> &enums) {
+    for_each_statement(statements, [&constants, &enums](Statement &statement) {
+        auto struct_ref = dynamic_cast<StructRefStatement*>(&statement);
+        if (!struct_ref)
+            return;
+        auto declaring = dynamic_cast<DeclaringStructRef*>(&*struct_ref->m_type);
+        if (!declaring)
+            return;
+        Struct &type = *declaring->m_declaration;
+        if (type.m_type == StructType::ENUM || type.m_type == StructType::FLAGS) {
+            enums.push_back(&type);
+            if (type.m_name)
+                constants.define_enum_constants(type);
+        }
+    });
+}
+
+static void build_enum_names(Struct &type, ConstantEvaluator &constants) {
+    auto names = make_unique<EnumNames>();
+    vector<int64_t> keys;
+    for (upStatement &statement : type.m_body) {
+        auto member = dynamic_cast<AssignmentStatement*>(&*statement);
+        if (!member || !member->m_is_assign_only)
+            return;
+        spRuntimeValue value;
+        int64_t key;
+        if (!constants.evaluate(*member->m_value, value) || value->m_type == RuntimeType::BOOLEAN || !SwitchStatement::to_jump_table_key(*value, key))
+            return;
+        names->m_members.emplace_back(member->m_name, value);
+        // flags are bit patterns, don't sign extend
+        keys.push_back(type.m_type == StructType::FLAGS && value->m_type == RuntimeType::INT ? static_cast<uint32_t>(key) : key);
+    }
+    if (names->m_members.empty())
+        return;
+
+    names->m_global = type.m_name != nullptr;
+    for (pair<string, spRuntimeValue> &member : names->m_members) {
+        if (type.m_name && constants.is_ambiguous(*type.m_name + "::" + member.first))
+            names->m_global = false;
+    }
+
+    if (type.m_type == StructType::ENUM) {
+        vector<pair<int64_t, const string*>> table;
+        for (size_t i = 0; i < keys.size(); i++)
+            table.emplace_back(keys[i], &names->m_members[i].first);
+        // the first of any aliases is the name that is shown
+        stable_sort(table.begin(), table.end(), [](const pair<int64_t, const string*> &a, const pair<int64_t, const string*> &b) { return a.first < b.first; });
+        table.erase(unique(table.begin(), table.end(), [](const pair<int64_t, const string*> &a, const pair<int64_t, const string*> &b) { return a.first == b.first; }), table.end());
+
+        int64_t min = table.front().first;
+        uint64_t range = static_cast<uint64_t>(table.back().first) - static_cast<uint64_t>(min);
+        if (range < 2 * table.size() + 16) {
+            names->m_dense_names.assign(range + 1, nullptr);
+            for (pair<int64_t, const string*> &entry : table)
+                names->m_dense_names[static_cast<uint64_t>(entry.first) - static_cast<uint64_t>(min)] = entry.second;
+        } else {
+            names->m_sparse_names = table;
+        }
+        names->m_min = min;
+    } else {
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto bits = static_cast<uint64_t>(keys[i]);
+            const string *name = &names->m_members[i].first;
+            if (bits != 0 && (bits & (bits - 1)) == 0) {
+                int bit = __builtin_ctzll(bits);
+                if (!names->m_bit_names[bit])
+                    names->m_bit_names[bit] = name;
+            } else if (bits != 0) {
+                names->m_mask_names.emplace_back(bits, name);
+            }
+        }
+    }
+
+    type.m_enum_names = move(names);
+}
+
+static void build_jump_table(SwitchStatement &switch_statement, ConstantEvaluator &constants) {
+    if (switch_statement.m_case_labels.empty())
+        return;
+
+    vector<pair<int64_t, int>> table;
+    for (pair<upExpression, int> &case_label : switch_statement.m_case_labels) {
+        spRuntimeValue value;
+        int64_t key;
+        if (!constants.evaluate(*case_label.first, value) || !SwitchStatement::to_jump_table_key(*value, key))
+            return;
+        table.emplace_back(key, case_label.second);
+    }
+
+    // the first of any duplicate labels wins, as it would when testing them in order
+    stable_sort(table.begin(), table.end(), [](const pair<int64_t, int> &a, const pair<int64_t, int> &b) { return a.first < b.first; });
+    table.erase(unique(table.begin(), table.end(), [](const pair<int64_t, int> &a, const pair<int64_t, int> &b) { return a.first == b.first; }), table.end());
+
+    int64_t min = table.front().first;
+    uint64_t range = static_cast<uint64_t>(table.back().first) - static_cast<uint64_t>(min);
+    if (range < 2 * table.size() + 16) {
+        switch_statement.m_dense_jump_table.assign(range + 1, -1);
+        for (pair<int64_t, int> &entry : table)
+            switch_statement.m_dense_jump_table[static_cast<uint64_t>(entry.first) - static_cast<uint64_t>(min)] = entry.second;
+    } else {
+        switch_statement.m_sparse_jump_table = table;
+    }
+    switch_statement.m_jump_table_min = min;
+    switch_statement.m_has_jump_table = true;
+}
+
+/// Every struct declared in the program, and the declarations of each name
+struct DeclaredStructs {
+    vector<Struct*> m_all;
+    // a name declared more than once can't be resolved without running the program
+    map<string, vector<Struct*>> m_named;
+
+    explicit DeclaredStructs(vector<upStatement> &statements) {
+        for_each_statement(statements, [this](Statement &statement) {
+            auto struct_ref = dynamic_cast<StructRefStatement*>(&statement);
+            if (!struct_ref)
+                return;
+            if (auto declaring = dynamic_cast<DeclaringStructRef*>(&*struct_ref->m_type)) {
+                Struct *type = &*declaring->m_declaration;
+                m_all.push_back(type);
+                if (type->m_name)
+                    m_named[*type->m_name].push_back(type);
+            }
+        });
+    }
+
+    // nullptr for names not declared in the program, which are primitives
+    vector<Struct*> *find(const string &name) {
+        auto itr = m_named.find(name);
+        return itr == m_named.end() ? nullptr : &itr->second;
+    }
+};
+
+/// Works out which structs are closed. Variables are resolved dynamically, through the structs a struct is used in,
+/// so a struct is closed if it declares every name it uses before using it, and every struct it uses is closed.
+/// Qualified names such as cp_type::CONSTANT_Utf8 are constants and don't count.
+class ClosureAnalysis {
+    DeclaredStructs &m_structs;
+
+    bool is_closed(Expression &expression, set<string> &declared) {
+        const string *name = nullptr;
+        if (auto reference = dynamic_cast<VarReferenceExpression*>(&expression))
+            name = &reference->m_name;
+        else if (auto increment = dynamic_cast<PreIncrementExpression*>(&expression))
+            name = &increment->m_var;
+        else if (auto increment = dynamic_cast<PostIncrementExpression*>(&expression))
+            name = &increment->m_var;
+        if (name && name->find("::") == string::npos && declared.find(*name) == declared.end())
+            return false;
+
+        bool closed = true;
+        expression.for_each_child([this, &closed, &declared](Expression &child) {
+            closed = closed && is_closed(child, declared);
+        });
+        return closed;
+    }
+
+    bool is_closed(StructRef &struct_ref, set<string> &declared) {
+        if (auto resolving = dynamic_cast<ResolvingStructRef*>(&struct_ref)) {
+            vector<Struct*> *declarations = m_structs.find(resolving->m_name);
+            // anything not declared in the program is a primitive
+            if (!declarations)
+                return true;
+            return declarations->size() == 1 && declarations->front()->m_closed;
+        }
+        // a struct declared in place can see everything declared so far, but what it declares stays inside it
+        set<string> body_declared = declared;
+        return is_body_closed(*dynamic_cast<DeclaringStructRef&>(struct_ref).m_declaration, body_declared);
+    }
+
+    bool is_body_closed(Struct &type, set<string> &declared) {
+        auto element_type = type.m_modifiers.find(StructModifierType::ELEMENT_TYPE);
+        if (element_type != type.m_modifiers.end() && !is_closed(*static_pointer_cast<StructRef>(element_type->second), declared))
+            return false;
+        if (type.m_type == StructType::ENUM || type.m_type == StructType::FLAGS) {
+            // the members are constants, which anonymous enums define unqualified
+            for (upStatement &statement : type.m_body) {
+                auto member = dynamic_cast<AssignmentStatement*>(&*statement);
+                if (!member || !is_closed(*member->m_value, declared))
+                    return false;
+                declared.insert(member->m_name);
+            }
+            return true;
+        }
+        for (upStatement &statement : type.m_body) {
+            if (!is_closed(*statement, declared))
+                return false;
+        }
+        return true;
+    }
+
+public:
+    explicit ClosureAnalysis(DeclaredStructs &structs) : m_structs(structs) {}
+
+    bool is_closed(Statement &statement, set<string> &declared) {
+        if (auto var_decl = dynamic_cast<VarDeclStatement*>(&statement)) {
+            for (pair<upVarDecl, upExpression> &decl : var_decl->m_declarations) {
+                for (upExpression &dimension : decl.first->m_dimensions) {
+                    if (!is_closed(*dimension, declared))
+                        return false;
+                }
+                if (decl.second && !is_closed(*decl.second, declared))
+                    return false;
+                declared.insert(decl.first->m_name);
+            }
+            return true;
+        }
+        if (auto assignment = dynamic_cast<AssignmentStatement*>(&statement))
+            return declared.find(assignment->m_name) != declared.end() && is_closed(*assignment->m_value, declared);
+        if (auto struct_ref = dynamic_cast<StructRefStatement*>(&statement)) {
+            if (!is_closed(*struct_ref->m_type, declared))
+                return false;
+            for (upVarDecl &decl : struct_ref->m_values) {
+                for (upExpression &dimension : decl->m_dimensions) {
+                    if (!is_closed(*dimension, declared))
+                        return false;
+                }
+                declared.insert(decl->m_name);
+            }
+            return true;
+        }
+
+        bool closed = true;
+        statement.for_each_child([this, &closed, &declared](Statement &child) {
+            closed = closed && is_closed(child, declared);
+        }, [this, &closed, &declared](Expression &child) {
+            closed = closed && is_closed(child, declared);
+        });
+        return closed;
+    }
+
+    void run() {
+        // start by assuming everything is closed, so recursive structs can be, and take it back until nothing changes
+        for (Struct *type : m_structs.m_all)
+            type->m_closed = true;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (Struct *type : m_structs.m_all) {
+                set<string> declared;
+                if (type->m_closed && !is_body_closed(*type, declared)) {
+                    type->m_closed = false;
+                    changed = true;
+                }
+            }
+        }
+
+        for (Struct *type : m_structs.m_all) {
+            if (type->m_type != StructType::CHOOSE)
+                continue;
+            type->m_closed_alternatives.clear();
+            for (upStatement &alternative : type->m_body) {
+                set<string> declared;
+                type->m_closed_alternatives.push_back(is_closed(*alternative, declared));
+            }
+        }
+    }
+};
+
+/// Works out which structs always decode the same number of bytes: primitives, enums and flags of them, and structs
+/// and unions made of nothing but struct refs to those, with constant array sizes.
+class FixedSizeAnalysis {
+    DeclaredStructs &m_structs;
+    ConstantEvaluator &m_constants;
+    // anything bigger than this is as good as unknown, and keeps the sums from overflowing
+    static const int64_t MAX_FIXED_SIZE = int64_t(1) << 40;
+
+    int64_t size_of(StructRef &struct_ref) {
+        if (auto declaring = dynamic_cast<DeclaringStructRef*>(&struct_ref))
+            return declaring->m_declaration->m_fixed_size;
+        auto &name = dynamic_cast<ResolvingStructRef&>(struct_ref).m_name;
+        if (vector<Struct*> *declarations = m_structs.find(name))
+            return declarations->size() == 1 ? declarations->front()->m_fixed_size : -1;
+        Struct *builtin = m_constants.builtin_struct(name);
+        return builtin ? builtin->m_fixed_size : -1;
+    }
+
+    int64_t size_of(StructRefStatement &struct_ref) {
+        int64_t element_size = size_of(*struct_ref.m_type);
+        if (element_size < 0)
+            return -1;
+        int64_t size = 0;
+        for (upVarDecl &decl : struct_ref.m_values) {
+            int64_t count = 1;
+            for (upExpression &dimension : decl->m_dimensions) {
+                spRuntimeValue value;
+                if (!m_constants.evaluate(*dimension, value) || value->m_type != RuntimeType::INT)
+                    return -1;
+                int64_t dimension_value = dynamic_cast<IntegerRuntimeValue&>(*value).m_value;
+                if (dimension_value < 0)
+                    return -1;
+                count *= dimension_value;
+                if (count > MAX_FIXED_SIZE)
+                    return -1;
+            }
+            size += element_size * count;
+            if (size > MAX_FIXED_SIZE)
+                return -1;
+        }
+        return size;
+    }
+
+    int64_t size_of(Struct &type) {
+        // arrays of these can skip elements
+        if (type.m_modifiers.find(StructModifierType::ARRAY_VALUE) != type.m_modifiers.end())
+            return -1;
+        switch (type.m_type) {
+            case StructType::ENUM:
+            case StructType::FLAGS: {
+                auto element_type = type.m_modifiers.find(StructModifierType::ELEMENT_TYPE);
+                if (element_type == type.m_modifiers.end())
+                    return -1;
+                return size_of(*static_pointer_cast<StructRef>(element_type->second));
+            }
+            case StructType::STRUCT:
+            case StructType::UNION:
+                break;
+            default:
+                return -1;
+        }
+        int64_t size = 0;
+        for (upStatement &statement : type.m_body) {
+            if (dynamic_cast<EmptyStatement*>(&*statement))
+                continue;
+            auto struct_ref = dynamic_cast<StructRefStatement*>(&*statement);
+            if (!struct_ref)
+                return -1;
+            int64_t member_size = size_of(*struct_ref);
+            if (member_size < 0)
+                return -1;
+            size = type.m_type == StructType::UNION ? max(size, member_size) : size + member_size;
+            if (size > MAX_FIXED_SIZE)
+                return -1;
+        }
+        return size;
+    }
+
+public:
+    FixedSizeAnalysis(DeclaredStructs &structs, ConstantEvaluator &constants) : m_structs(structs), m_constants(constants) {}
+
+    // sizes only ever go from unknown to known, so this stops
+    void run() {
+        for (Struct *type : m_structs.m_all)
+            type->m_fixed_size = -1;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (Struct *type : m_structs.m_all) {
+                if (type->m_fixed_size >= 0)
+                    continue;
+                type->m_fixed_size = size_of(*type);
+                changed = changed || type->m_fixed_size >= 0;
+            }
+        }
+    }
+};
+
+static void collect_referenced_names(Expression &expression, set<string> &names) {
+    if (auto reference = dynamic_cast<VarReferenceExpression*>(&expression))
+        names.insert(reference->m_name);
+    else if (auto field_access = dynamic_cast<FieldAccessExpression*>(&expression))
+        names.insert(field_access->m_field);
+    else if (auto increment = dynamic_cast<PreIncrementExpression*>(&expression))
+        names.insert(increment->m_var);
+    else if (auto increment = dynamic_cast<PostIncrementExpression*>(&expression))
+        names.insert(increment->m_var);
+    expression.for_each_child([&names](Expression &child) { collect_referenced_names(child, names); });
+}
+
+/// Calls fn on the statements which run as part of the given one, without going into the bodies of struct refs
+static void for_each_own_statement(Statement &statement, const function<void(Statement&)> &fn) {
+    fn(statement);
+    if (dynamic_cast<StructRefStatement*>(&statement))
+        return;
+    statement.for_each_child([&fn](Statement &child) { for_each_own_statement(child, fn); }, [](Expression&) {});
+}
+
+/// Marks the struct refs whose values nothing reads back. Names are resolved dynamically, so this goes by name: a
+/// value is read back if its name is used anywhere in the program. A struct whose value is read back, e.g. to be
+/// printed, reads back everything in it, and everything in the structs in it. Decoding a struct also declares the
+/// structs, enums and flags in it, so one which declares any used elsewhere, by name or by their members, is decoded
+/// too.
+static void find_skippable_struct_refs(vector<upStatement> &statements, DeclaredStructs &structs) {
+    set<string> referenced;
+    for_each_statement(statements, [&referenced](Statement &statement) {
+        if (auto assignment = dynamic_cast<AssignmentStatement*>(&statement))
+            referenced.insert(assignment->m_name);
+        statement.for_each_child([](Statement&) {}, [&referenced](Expression &expression) {
+            collect_referenced_names(expression, referenced);
+        });
+    });
+    auto is_referenced = [&referenced](StructRefStatement &struct_ref) {
+        for (upVarDecl &decl : struct_ref.m_values) {
+            if (referenced.find(decl->m_name) != referenced.end())
+                return true;
+        }
+        return false;
+    };
+    auto types_of = [&structs](StructRefStatement &struct_ref) {
+        vector<Struct*> types;
+        if (auto declaring = dynamic_cast<DeclaringStructRef*>(&*struct_ref.m_type))
+            types.push_back(&*declaring->m_declaration);
+        else if (vector<Struct*> *declarations = structs.find(dynamic_cast<ResolvingStructRef&>(*struct_ref.m_type).m_name))
+            types = *declarations;
+        return types;
+    };
+
+    set<string> used_types;
+    for_each_statement(statements, [&used_types](Statement &statement) {
+        auto struct_ref = dynamic_cast<StructRefStatement*>(&statement);
+        if (!struct_ref)
+            return;
+        if (auto resolving = dynamic_cast<ResolvingStructRef*>(&*struct_ref->m_type))
+            used_types.insert(resolving->m_name);
+    });
+    auto is_used = [&referenced, &used_types](Struct &type) {
+        if (type.m_name && used_types.find(*type.m_name) != used_types.end())
+            return true;
+        if (type.m_type != StructType::ENUM && type.m_type != StructType::FLAGS)
+            return false;
+        for (upStatement &statement : type.m_body) {
+            auto member = dynamic_cast<AssignmentStatement*>(&*statement);
+            if (member && referenced.find(type.m_name ? *type.m_name + "::" + member->m_name : member->m_name) != referenced.end())
+                return true;
+        }
+        return false;
+    };
+    // structs which declare a used one in them, or in the structs in them
+    set<Struct*> declaring;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (Struct *type : structs.m_all) {
+            if (declaring.find(type) != declaring.end())
+                continue;
+            bool declares = false;
+            for (upStatement &statement : type->m_body) {
+                for_each_own_statement(*statement, [&](Statement &own) {
+                    auto struct_ref = dynamic_cast<StructRefStatement*>(&own);
+                    if (!struct_ref)
+                        return;
+                    if (auto declaration = dynamic_cast<DeclaringStructRef*>(&*struct_ref->m_type))
+                        declares = declares || is_used(*declaration->m_declaration);
+                    for (Struct *member_type : types_of(*struct_ref))
+                        declares = declares || declaring.find(member_type) != declaring.end();
+                });
+            }
+            if (declares) {
+                declaring.insert(type);
+                changed = true;
+            }
+        }
+    }
+    auto declares_used = [&declaring, &types_of](StructRefStatement &struct_ref) {
+        for (Struct *type : types_of(struct_ref)) {
+            if (declaring.find(type) != declaring.end())
+                return true;
+        }
+        return false;
+    };
+
+    set<Struct*> escaping;
+    vector<Struct*> pending;
+    auto escape = [&escaping, &pending](Struct *type) {
+        if (escaping.insert(type).second)
+            pending.push_back(type);
+    };
+    for_each_statement(statements, [&](Statement &statement) {
+        auto struct_ref = dynamic_cast<StructRefStatement*>(&statement);
+        if (struct_ref && is_referenced(*struct_ref)) {
+            for (Struct *type : types_of(*struct_ref))
+                escape(type);
+        }
+    });
+    while (!pending.empty()) {
+        Struct *type = pending.back();
+        pending.pop_back();
+        for (upStatement &statement : type->m_body) {
+            for_each_own_statement(*statement, [&](Statement &own) {
+                if (auto struct_ref = dynamic_cast<StructRefStatement*>(&own)) {
+                    for (Struct *member_type : types_of(*struct_ref))
+                        escape(member_type);
+                }
+            });
+        }
+    }
+
+    auto mark = [&](Statement &statement, bool owner_escapes) {
+        for_each_own_statement(statement, [&](Statement &own) {
+            if (auto struct_ref = dynamic_cast<StructRefStatement*>(&own))
+                struct_ref->m_skippable = !owner_escapes && !is_referenced(*struct_ref) && !declares_used(*struct_ref);
+        });
+    };
+    for (upStatement &statement : statements)
+        mark(*statement, false);
+    for (Struct *type : structs.m_all) {
+        for (upStatement &statement : type->m_body)
+            mark(*statement, escaping.find(type) != escaping.end());
+    }
+}
+
+/// A type worked out by TypeInference: nothing known yet, always the same type, or any type
+struct InferredType {
+    enum Kind { NONE, ONE, ANY };
+    Kind kind = NONE;
+    RuntimeType type = RuntimeType::INT;
+
+    static InferredType of(RuntimeType type) { return {ONE, type}; }
+    static InferredType any() { return {ANY, RuntimeType::INT}; }
+
+    // the type of something which is sometimes one and sometimes the other
+    InferredType join(const InferredType &other) const {
+        if (kind == NONE)
+            return other;
+        if (other.kind == NONE || (kind == ONE && other.kind == ONE && type == other.type))
+            return *this;
+        return any();
+    }
+    bool operator!=(const InferredType &other) const {
+        return kind != other.kind || (kind == ONE && type != other.type);
+    }
+};
+
+/// Works out the types of expressions, and gives operators whose operands always have the same types an operator for
+/// those types. Names are resolved dynamically, so as in find_skippable_struct_refs this goes by name: a name has a
+/// type if everything that defines it, anywhere in the program, gives it that type. This starts with nothing known
+/// and goes until nothing changes, so that a variable also defined in terms of itself, e.g. by i += 1, can still have
+/// a type.
+class TypeInference {
+    // the value of the name is the value's type, or the result of op on the name and the value
+    struct Definition {
+        const string *name;
+        InferredType type;
+        Expression *value;
+        string op;
+    };
+
+    DeclaredStructs &m_structs;
+    ConstantEvaluator &m_constants;
+    vector<Definition> m_definitions;
+    map<string, InferredType> m_names;
+    // once set, names still not known could be anything
+    bool m_settled = false;
+
+    static RuntimeType primitive_type(Struct &primitive) {
+        switch (primitive.m_primitive_type) {
+            case PrimitiveType::U8:
+            case PrimitiveType::S8:
+            case PrimitiveType::VARINT:
+            case PrimitiveType::ZIGZAG:
+                return RuntimeType::LONG;
+            case PrimitiveType::BITS:
+                return primitive.m_bit_width > 32 ? RuntimeType::LONG : RuntimeType::INT;
+            case PrimitiveType::F4:
+                return RuntimeType::FLOAT;
+            case PrimitiveType::F8:
+                return RuntimeType::DOUBLE;
+            default:
+                return RuntimeType::INT;
+        }
+    }
+
+    // the element type of enums and flags, which can only be a primitive
+    InferredType element_type_of(StructRef &struct_ref) {
+        auto resolving = dynamic_cast<ResolvingStructRef*>(&struct_ref);
+        if (!resolving || m_structs.find(resolving->m_name))
+            return InferredType::any();
+        Struct *builtin = m_constants.builtin_struct(resolving->m_name);
+        return builtin && builtin->m_type == StructType::PRIMITIVE ? InferredType::of(primitive_type(*builtin)) : InferredType::any();
+    }
+
+    InferredType type_of(Struct &type) {
+        if (type.m_type == StructType::PRIMITIVE)
+            return InferredType::of(primitive_type(type));
+        if (type.m_type != StructType::ENUM && type.m_type != StructType::FLAGS)
+            return InferredType::any();
+        auto element_type = type.m_modifiers.find(StructModifierType::ELEMENT_TYPE);
+        if (element_type == type.m_modifiers.end())
+            return InferredType::any();
+        return element_type_of(*static_pointer_cast<StructRef>(element_type->second));
+    }
+
+    InferredType type_of(StructRef &struct_ref) {
+        if (auto declaring = dynamic_cast<DeclaringStructRef*>(&struct_ref))
+            return type_of(*declaring->m_declaration);
+        const string &name = dynamic_cast<ResolvingStructRef&>(struct_ref).m_name;
+        if (vector<Struct*> *declarations = m_structs.find(name)) {
+            InferredType ret;
+            for (Struct *type : *declarations)
+                ret = ret.join(type_of(*type));
+            return ret;
+        }
+        Struct *builtin = m_constants.builtin_struct(name);
+        return builtin ? type_of(*builtin) : InferredType::any();
+    }
+
+    InferredType type_of_name(const string &name) {
+        auto itr = m_names.find(name);
+        if (itr == m_names.end())
+            return m_settled ? InferredType::any() : InferredType();
+        return itr->second;
+    }
+
+    static InferredType result_of(const string &op, InferredType left, InferredType right) {
+        if (left.kind == InferredType::ANY || right.kind == InferredType::ANY)
+            return InferredType::any();
+        if (left.kind == InferredType::NONE || right.kind == InferredType::NONE)
+            return InferredType();
+        TypedBinaryOperator typed = get_typed_binary_operator(op, left.type, right.type);
+        return typed.apply ? InferredType::of(typed.result) : InferredType::any();
+    }
+
+    InferredType type_of(Expression &expression) {
+        if (auto literal = dynamic_cast<LiteralExpression*>(&expression))
+            return InferredType::of(literal->m_value->m_type);
+        if (auto reference = dynamic_cast<VarReferenceExpression*>(&expression)) {
+            // builtin variables and members of named enums
+            spRuntimeValue value;
+            if (reference->m_name.find("::") != string::npos)
+                return m_constants.evaluate(expression, value) ? InferredType::of(value->m_type) : InferredType::any();
+            return type_of_name(reference->m_name);
+        }
+        if (auto field_access = dynamic_cast<FieldAccessExpression*>(&expression))
+            return type_of_name(field_access->m_field);
+        if (auto increment = dynamic_cast<PreIncrementExpression*>(&expression))
+            return result_of("+", type_of_name(increment->m_var), InferredType::of(RuntimeType::INT));
+        if (auto increment = dynamic_cast<PostIncrementExpression*>(&expression))
+            return type_of_name(increment->m_var);
+        if (auto binary = dynamic_cast<BinaryOperatorExpression*>(&expression))
+            return result_of(binary->m_op, type_of(*binary->m_left), type_of(*binary->m_right));
+        if (auto unary = dynamic_cast<UnaryOperatorExpression*>(&expression)) {
+            InferredType operand = type_of(*unary->m_expr);
+            if (operand.kind != InferredType::ONE)
+                return operand;
+            TypedUnaryOperator typed = get_typed_unary_operator(unary->m_op, operand.type);
+            return typed.apply ? InferredType::of(typed.result) : InferredType::any();
+        }
+        return InferredType::any();
+    }
+
+    InferredType type_of(Definition &definition) {
+        InferredType value = definition.value ? type_of(*definition.value) : definition.type;
+        if (definition.op.empty())
+            return value;
+        return result_of(definition.op, type_of_name(*definition.name), value);
+    }
+
+    void define(const string &name, InferredType type) {
+        m_definitions.push_back({&name, type, nullptr, ""});
+    }
+
+    void collect_definitions(vector<upStatement> &statements) {
+        set<Statement*> enum_members;
+        for (Struct *type : m_structs.m_all) {
+            auto array_value = type->m_modifiers.find(StructModifierType::ARRAY_VALUE);
+            if (array_value != type->m_modifiers.end())
+                define(*static_cast<string*>(array_value->second.get()), InferredType::of(RuntimeType::INT));
+            if (type->m_type != StructType::ENUM && type->m_type != StructType::FLAGS)
+                continue;
+            for (upStatement &statement : type->m_body) {
+                enum_members.insert(&*statement);
+                // members of named enums are only defined qualified, see type_of
+                auto member = dynamic_cast<AssignmentStatement*>(&*statement);
+                spRuntimeValue value;
+                if (member && !type->m_name)
+                    define(member->m_name, m_constants.evaluate(*member->m_value, value) ? InferredType::of(value->m_type) : InferredType::any());
+            }
+        }
+
+        for_each_statement(statements, [this, &enum_members](Statement &statement) {
+            if (auto struct_ref = dynamic_cast<StructRefStatement*>(&statement)) {
+                InferredType type = type_of(*struct_ref->m_type);
+                for (upVarDecl &decl : struct_ref->m_values)
+                    define(decl->m_name, decl->m_dimensions.empty() ? type : InferredType::any());
+            } else if (auto var_decl = dynamic_cast<VarDeclStatement*>(&statement)) {
+                for (pair<upVarDecl, upExpression> &decl : var_decl->m_declarations) {
+                    if (!decl.first->m_dimensions.empty())
+                        define(decl.first->m_name, InferredType::any());
+                    else if (decl.second)
+                        m_definitions.push_back({&decl.first->m_name, InferredType(), &*decl.second, ""});
+                }
+            } else if (auto assignment = dynamic_cast<AssignmentStatement*>(&statement)) {
+                if (enum_members.find(&statement) != enum_members.end())
+                    return;
+                // e.g. += is defined by +
+                string op = assignment->m_is_assign_only ? "" : assignment->m_op.substr(0, assignment->m_op.length() - 1);
+                m_definitions.push_back({&assignment->m_name, InferredType(), &*assignment->m_value, op});
+            }
+            statement.for_each_child([](Statement&) {}, [this](Expression &expression) { collect_increments(expression); });
+        });
+    }
+
+    void collect_increments(Expression &expression) {
+        if (auto increment = dynamic_cast<PreIncrementExpression*>(&expression))
+            m_definitions.push_back({&increment->m_var, InferredType::of(RuntimeType::INT), nullptr, "+"});
+        else if (auto increment = dynamic_cast<PostIncrementExpression*>(&expression))
+            m_definitions.push_back({&increment->m_var, InferredType::of(RuntimeType::INT), nullptr, "+"});
+        expression.for_each_child([this](Expression &child) { collect_increments(child); });
+    }
+
+    void infer() {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (Definition &definition : m_definitions) {
+                InferredType &type = m_names[*definition.name];
+                InferredType joined = type.join(type_of(definition));
+                if (joined != type) {
+                    type = joined;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    void annotate(Expression &expression) {
+        if (auto binary = dynamic_cast<BinaryOperatorExpression*>(&expression)) {
+            InferredType left = type_of(*binary->m_left);
+            InferredType right = type_of(*binary->m_right);
+            if (left.kind == InferredType::ONE && right.kind == InferredType::ONE)
+                binary->m_typed = get_typed_binary_operator(binary->m_op, left.type, right.type);
+        } else if (auto unary = dynamic_cast<UnaryOperatorExpression*>(&expression)) {
+            InferredType operand = type_of(*unary->m_expr);
+            if (operand.kind == InferredType::ONE)
+                unary->m_typed = get_typed_unary_operator(unary->m_op, operand.type);
+        }
+        expression.for_each_child([this](Expression &child) { annotate(child); });
+    }
+
+public:
+    TypeInference(DeclaredStructs &structs, ConstantEvaluator &constants) : m_structs(structs), m_constants(constants) {}
+
+    void run(vector<upStatement> &statements) {
+        collect_definitions(statements);
+        infer();
+        // names only defined in terms of themselves could be anything
+        for (pair<const string, InferredType> &name : m_names) {
+            if (name.second.kind == InferredType::NONE)
+                name.second = InferredType::any();
+        }
+        m_settled = true;
+        infer();
+
+        for_each_statement(statements, [this](Statement &statement) {
+            statement.for_each_child([](Statement&) {}, [this](Expression &expression) { annotate(expression); });
+        });
+    }
+};
+
+void compile(vector<upStatement> &statements) {
+    ConstantEvaluator constants;
+    vector<Struct*> enums;
+    collect_enums(statements, constants, enums);
+    for (Struct *type : enums)
+        build_enum_names(*type, constants);
+
+    for_each_statement(statements, [&constants](Statement &statement) {
+        if (auto switch_statement = dynamic_cast<SwitchStatement*>(&statement))
+            build_jump_table(*switch_statement, constants);
+    });
+
+    DeclaredStructs structs(statements);
+    ClosureAnalysis(structs).run();
+    FixedSizeAnalysis(structs, constants).run();
+    find_skippable_struct_refs(statements, structs);
+    TypeInference(structs, constants).run(statements);
+}
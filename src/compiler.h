@@ -0,0 +1,18 @@
+
+#ifndef DECODE_BIN_COMPILER_H
+#define DECODE_BIN_COMPILER_H
+
+#include <vector>
+#include "ast.h"
+
+/// Passes over the parsed tree which run once before it is executed:
+///  - enums and flags whose members are all constants get tables from values to member names
+///  - switch statements whose case labels are all constants get a jump table
+///  - structs, and the alternatives of choose, which don't depend on variables from outside are marked closed
+///  - structs which always decode the same number of bytes get their size
+///  - struct refs whose values are never read back are marked skippable, so they aren't kept once they're output
+///  - operators whose operands always have the same types, e.g. an int compared with an int, get an operator for
+///    those types, which doesn't have to look them up
+void compile(std::vector<upStatement> &statements);
+
+#endif //DECODE_BIN_COMPILER_H
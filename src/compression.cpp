@@ -0,0 +1,155 @@
+
+#include "compression.h"
+#include <cstdio>
+#include <zlib.h>
+#include "input.h"
+
+using namespace std;
+
+const size_t CHUNK_SIZE = 1 << 16;
+
+Compression detect_compression(const uint8_t *data, size_t length) {
+    if (length >= 3 && data[0] == 0x1f && data[1] == 0x8b && data[2] == 8)
+        return Compression::GZIP;
+    // deflate with at most a 32K window, and the header checksum
+    if (length >= 2 && (data[0] & 0x0f) == 8 && (data[0] >> 4) <= 7 && ((data[0] << 8) | data[1]) % 31 == 0)
+        return Compression::ZLIB;
+    return Compression::NONE;
+}
+
+static int window_bits(Compression compression) {
+    switch (compression) {
+        case Compression::GZIP:
+            return 16 + MAX_WBITS;
+        case Compression::ZLIB:
+            return MAX_WBITS;
+        default:
+            return -MAX_WBITS;
+    }
+}
+
+/// Inflates chunks of compressed data as they are read, so the whole of it is never held at once
+class Inflater {
+    z_stream m_stream = {};
+    Compression m_compression;
+    bool m_initialized = false;
+    bool m_finished = false;
+    // a gzip member ended with the chunk, whether another follows is only known from the next one
+    bool m_member_ended = false;
+public:
+    explicit Inflater(Compression compression) : m_compression(compression) {}
+    ~Inflater() {
+        if (m_initialized)
+            inflateEnd(&m_stream);
+    }
+
+    bool init(string &error) {
+        if (inflateInit2(&m_stream, window_bits(m_compression)) != Z_OK) {
+            error = "Failed to initialize zlib";
+            return false;
+        }
+        m_initialized = true;
+        return true;
+    }
+
+    // finished once the end of the stream has been reached, anything after it is ignored
+    bool finished() { return m_finished; }
+    // whether the input can end here: finished, or at the end of a gzip member
+    bool complete() { return m_finished || m_member_ended; }
+
+    bool inflate_chunk(const uint8_t *data, size_t length, vector<uint8_t> &out, string &error) {
+        m_stream.next_in = const_cast<uint8_t*>(data);
+        m_stream.avail_in = static_cast<uInt>(length);
+        if (m_member_ended) {
+            m_member_ended = false;
+            if (length == 0 || data[0] != 0x1f) {
+                m_finished = true;
+                return true;
+            }
+            inflateReset(&m_stream);
+        }
+        while (true) {
+            size_t size = out.size();
+            out.resize(size + CHUNK_SIZE);
+            m_stream.next_out = out.data() + size;
+            m_stream.avail_out = static_cast<uInt>(CHUNK_SIZE);
+            int result = ::inflate(&m_stream, Z_NO_FLUSH);
+            out.resize(size + CHUNK_SIZE - m_stream.avail_out);
+            if (result == Z_STREAM_END) {
+                // gzip files may be several members one after another
+                if (m_compression == Compression::GZIP && m_stream.avail_in == 0) {
+                    m_member_ended = true;
+                    return true;
+                }
+                if (m_compression == Compression::GZIP && m_stream.next_in[0] == 0x1f) {
+                    inflateReset(&m_stream);
+                    continue;
+                }
+                m_finished = true;
+                return true;
+            }
+            // a buffer error only means everything given has been used up
+            if (result != Z_OK && !(result == Z_BUF_ERROR && m_stream.avail_in == 0)) {
+                error = m_stream.msg ? m_stream.msg : "inflate failed";
+                return false;
+            }
+            if (m_stream.avail_in == 0 && m_stream.avail_out != 0)
+                return true;
+        }
+    }
+};
+
+bool inflate_data(const uint8_t *data, size_t length, Compression compression, vector<uint8_t> &out, string &error) {
+    Inflater inflater(compression);
+    if (!inflater.init(error) || !inflater.inflate_chunk(data, length, out, error))
+        return false;
+    if (!inflater.complete()) {
+        error = "compressed data is cut short";
+        return false;
+    }
+    return true;
+}
+
+bool read_compressed_input_file(const string &filename, Compression compression, vector<uint8_t> &data, string &error) {
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        error = "Failed to open input file";
+        return false;
+    }
+    vector<uint8_t> buf(CHUNK_SIZE);
+    size_t count = fread(buf.data(), 1, buf.size(), file);
+    bool detected = compression == Compression::AUTO;
+    if (detected)
+        compression = detect_compression(buf.data(), count);
+    if (compression == Compression::NONE) {
+        fclose(file);
+        if (!read_input_file(filename, data)) {
+            error = "Failed to open input file";
+            return false;
+        }
+        return true;
+    }
+
+    Inflater inflater(compression);
+    bool ok = inflater.init(error);
+    while (ok && count != 0 && !inflater.finished()) {
+        ok = inflater.inflate_chunk(buf.data(), count, data, error);
+        count = fread(buf.data(), 1, buf.size(), file);
+    }
+    if (ok && ferror(file)) {
+        error = "Failed to read input file";
+        ok = false;
+    } else if (ok && !inflater.complete()) {
+        error = "compressed data is cut short";
+        ok = false;
+    }
+    fclose(file);
+
+    if (!ok && detected && compression == Compression::ZLIB) {
+        data.clear();
+        return read_compressed_input_file(filename, Compression::NONE, data, error);
+    }
+    if (!ok)
+        error = "Failed to decompress input file: " + error;
+    return ok;
+}
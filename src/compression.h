@@ -0,0 +1,24 @@
+
+#ifndef DECODE_BIN_COMPRESSION_H
+#define DECODE_BIN_COMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class Compression {
+    // detect gzip and zlib from their headers, raw deflate has none so is never detected
+    AUTO, NONE, GZIP, ZLIB, RAW_DEFLATE
+};
+
+Compression detect_compression(const uint8_t *data, size_t length);
+
+// Inflates data onto the end of out. Returns false with a message if it is malformed or cut short.
+bool inflate_data(const uint8_t *data, size_t length, Compression compression, std::vector<uint8_t> &out, std::string &error);
+
+// Like read_input_file, but inflating the file as it is read unless it is NONE, or AUTO and not compressed. Input
+// that only looks like zlib (its header is just two bytes with a checksum) and doesn't inflate is read as it is.
+bool read_compressed_input_file(const std::string &filename, Compression compression, std::vector<uint8_t> &data, std::string &error);
+
+#endif //DECODE_BIN_COMPRESSION_H
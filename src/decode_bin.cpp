@@ -1,16 +1,66 @@
 
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <vector>
 #include "util.h"
 #include "tokenizer.h"
 #include "parser.h"
+#include "compiler.h"
+#include "input.h"
+#include "follow.h"
+#include "compression.h"
+#include "zip.h"
+#include "output_writer.h"
+#include "batch_reader.h"
 
 using namespace std;
 
 void print_usage(char *program_name) {
-    cout << program_name << " <binformat_file>" << endl;
+    cout << program_name << " [options] <binformat_file> <input_file>" << endl;
+    cout << program_name << " [options] <binformat_file> --zip <archive> [-j N]" << endl;
+    cout << program_name << " [options] <binformat_file> --dir <directory> [-j N]" << endl;
+    cout << "Options:" << endl;
+    cout << "  --profile  print execution counts and times for each statement and struct to stderr" << endl;
+    cout << "  --memo N   remember up to N decoded structs which don't depend on their surroundings, and reuse them" << endl;
+    cout << "             when the same struct is decoded from the same place again, hit counts go to stderr" << endl;
+    cout << "  --follow   keep decoding the input file as it grows, like tail -f: the last top level statement is a record" << endl;
+    cout << "             which is decoded again for each one appended, and one only partly written is waited for" << endl;
+    cout << "  --checkpoint-every N" << endl;
+    cout << "             save the state to a checkpoint file after every N top level statements (or records with" << endl;
+    cout << "             --follow), to carry on from with --resume" << endl;
+    cout << "  --checkpoint FILE" << endl;
+    cout << "             the checkpoint file, by default the input file with .checkpoint appended" << endl;
+    cout << "  --resume   carry on from the checkpoint file, cutting the output back to where it was if it's a file" << endl;
+    cout << "  --raw-deflate" << endl;
+    cout << "             the input file is raw deflate data, gzip and zlib input is inflated without being asked" << endl;
+    cout << "  --no-decompress" << endl;
+    cout << "             decode the input file as it is, even if it looks compressed" << endl;
+    cout << "  --zip ARCHIVE" << endl;
+    cout << "             decode every entry of a ZIP archive, such as a jar, each output as a struct named after it" << endl;
+    cout << "  --zip-suffix SUFFIX" << endl;
+    cout << "             only decode the entries whose names end with this, e.g. .class" << endl;
+    cout << "  --dir DIRECTORY" << endl;
+    cout << "             decode every file in a directory, each output as a struct named after it, like --zip" << endl;
+    cout << "  --queue-depth N" << endl;
+    cout << "             with --dir, read up to N files at a time, on threads of their own (default 64)" << endl;
+    cout << "  --io-stats with --dir, print how the files were read to stderr, including the system calls made" << endl;
+    cout << "  -j N       decode N archive entries or files at a time (default the number of CPUs)" << endl;
+    cout << "  --pipeline read the input file while the binformat is compiled, and write the output on a thread of its own" << endl;
+    cout << "             while decoding carries on, the output is the same" << endl;
+    cout << "  --select path[,path...]" << endl;
+    cout << "             only output these fields, e.g. magic,constant_pool[*].tag, and what is printed inside them" << endl;
 }
 
 void read_lines(ifstream &file, vector<string> &lines) {
@@ -20,37 +70,438 @@ void read_lines(ifstream &file, vector<string> &lines) {
     }
 }
 
-void print_token_range(const vector<string> &lines, Token begin_token, Token end_token, string padding) {
+void print_token_range(ostream &out, const vector<string> &lines, Token begin_token, Token end_token, string padding) {
     if (begin_token.line == end_token.line) {
-        cerr << padding << lines[begin_token.line - 1] << endl;
+        out << padding << lines[begin_token.line - 1] << endl;
         Token compound_token = {
                 lines[begin_token.line - 1].substr(begin_token.col, end_token.col + end_token.value.length() - begin_token.col),
                 begin_token.line, begin_token.col
         };
-        cerr << padding << create_underline(compound_token) << endl;
+        out << padding << create_underline(compound_token) << endl;
     } else {
-        cerr << padding << lines[begin_token.line - 1] << endl;
+        out << padding << lines[begin_token.line - 1] << endl;
         Token compound_token = {lines[begin_token.line - 1].substr(begin_token.col), begin_token.line, begin_token.col};
-        cerr << padding << create_underline(compound_token) << endl;
+        out << padding << create_underline(compound_token) << endl;
         if (end_token.line != begin_token.line + 1) {
-            cerr << padding << "... " << (end_token.line - begin_token.line - 1) << " " << (end_token.line == begin_token.line + 2 ? "line" : "lines") << " omitted" << endl;
+            out << padding << "... " << (end_token.line - begin_token.line - 1) << " " << (end_token.line == begin_token.line + 2 ? "line" : "lines") << " omitted" << endl;
         }
-        cerr << padding << lines[end_token.line - 1] << endl;
+        out << padding << lines[end_token.line - 1] << endl;
         compound_token = {lines[end_token.line - 1].substr(0, end_token.col + end_token.value.length()), end_token.line, 0};
-        cerr << padding << create_underline(compound_token) << endl;
+        out << padding << create_underline(compound_token) << endl;
     }
 }
 
+void print_error(ostream &out, const vector<string> &lines, string &error, vector<Statement*> &executing_statements, vector<Expression*> &evaluating_expressions) {
+    // e.g. a checkpoint which can't be resumed from, which isn't anywhere in the binformat
+    if (executing_statements.empty() && evaluating_expressions.empty()) {
+        out << error << endl;
+        return;
+    }
+    Token begin_token, end_token;
+    if (evaluating_expressions.empty()) {
+        begin_token = executing_statements.back()->m_begin_token;
+        end_token = executing_statements.back()->m_end_token;
+    } else {
+        begin_token = evaluating_expressions.back()->m_begin_token;
+        end_token = evaluating_expressions.back()->m_end_token;
+    }
+    out << ":" << begin_token.line << ":" << begin_token.col << ": " << error << endl;
+    print_token_range(out, lines, begin_token, end_token, "");
+
+    auto it = executing_statements.rbegin();
+    if (evaluating_expressions.empty()) ++it;
+    for (; it != executing_statements.rend(); ++it) {
+        out << "  at :" << (*it)->m_begin_token.line << ":" << (*it)->m_begin_token.col << endl;
+        print_token_range(out, lines, (*it)->m_begin_token, (*it)->m_end_token, "    ");
+    }
+}
+
+struct ProfileReportLine {
+    ProfileEntry *entry;
+    string label;
+    Token begin_token, end_token;
+};
+
+void print_profile(const vector<string> &lines, Profiler &profiler) {
+    vector<ProfileReportLine> report;
+    for (auto &statement : profiler.m_statements)
+        report.push_back({&statement.second, "statement", statement.first->m_begin_token, statement.first->m_end_token});
+    for (auto &type : profiler.m_structs) {
+        string label = type.first->m_name ? "struct " + *type.first->m_name : "anonymous struct";
+        report.push_back({&type.second, label, type.first->m_begin_token, type.first->m_end_token});
+    }
+    sort(report.begin(), report.end(), [](const ProfileReportLine &a, const ProfileReportLine &b) {
+        return a.entry->exclusive_ns > b.entry->exclusive_ns;
+    });
+
+    cerr << "Profile, sorted by exclusive time:" << endl;
+    for (ProfileReportLine &line : report) {
+        ProfileEntry &entry = *line.entry;
+        cerr << line.label;
+        if (line.begin_token.line != 0)
+            cerr << " at :" << line.begin_token.line << ":" << line.begin_token.col;
+        cerr << ": count " << entry.count
+             << ", exclusive " << entry.exclusive_ns / 1000 << "us"
+             << ", inclusive " << entry.inclusive_ns / 1000 << "us"
+             << ", bytes " << entry.bytes << endl;
+        if (line.begin_token.line != 0)
+            print_token_range(cerr, lines, line.begin_token, line.end_token, "    ");
+    }
+}
+
+// buffers of OUTPUT_BUFFER_SIZE waiting to be written with --pipeline, before decoding waits for the output
+const size_t PIPELINE_DEPTH = 8;
+
+/// What decoding one entry of an archive, or file of a directory, produced, kept until it's its turn to be output
+struct EntryResult {
+    string output;
+    ostringstream errors;
+    bool success = false;
+    bool done = false;
+};
+
+static void append_indented(string &out, const char *text, size_t length) {
+    bool line_start = true;
+    for (size_t i = 0; i < length; i++) {
+        if (line_start)
+            out += "  ";
+        out += text[i];
+        line_start = text[i] == '\n';
+    }
+    if (!line_start)
+        out += '\n';
+}
+
+/// Gives decode_entries the next entry to decode, called from any of its threads: the entry's index, and its data or
+/// nullptr and an error to report for it. Returns false once there are none left.
+typedef function<bool(size_t &index, spInputData &data, string &error)> NextEntry;
+
+/// Decodes entries on jobs threads, each with an interpreter of its own, sharing the compiled statements. Each entry is
+/// output as a struct named after it, in the order of names whichever finishes first.
+static bool decode_entries(const vector<string> &names, const NextEntry &next_entry, unsigned jobs, vector<upStatement> &statements,
+                           const vector<string> &lines, const InterpreterOptions &options, long memo_capacity) {
+    vector<EntryResult> results(names.size());
+    mutex results_mutex;
+    condition_variable result_done;
+    uint64_t memo_hits = 0, memo_misses = 0, memo_evictions = 0;
+
+    auto worker = [&]() {
+        StructMemo struct_memo(memo_capacity < 0 ? 0 : static_cast<size_t>(memo_capacity));
+        InterpreterOptions worker_options = options;
+        if (memo_capacity >= 0)
+            worker_options.struct_memo = &struct_memo;
+        size_t i;
+        spInputData data;
+        string entry_error;
+        while (next_entry(i, data, entry_error)) {
+            EntryResult &result = results[i];
+            if (!data) {
+                result.errors << entry_error << endl;
+            } else {
+                char *output = nullptr;
+                size_t output_size = 0;
+                worker_options.output_file = open_memstream(&output, &output_size);
+                try {
+                    result.success = execute(statements, Input(move(data)), worker_options, [&lines, &result](string &error, vector<Statement*> &executing_statements, vector<Expression*> &evaluating_expressions) {
+                        print_error(result.errors, lines, error, executing_statements, evaluating_expressions);
+                    });
+                } catch (exception &error) {
+                    // such as running out of memory, which only fails this entry
+                    result.errors << error.what() << endl;
+                }
+                fclose(worker_options.output_file);
+                result.output = names[i] + " {\n";
+                append_indented(result.output, output, output_size);
+                result.output += "}\n";
+                free(output);
+            }
+            data = nullptr;
+            lock_guard<mutex> lock(results_mutex);
+            result.done = true;
+            result_done.notify_all();
+        }
+        lock_guard<mutex> lock(results_mutex);
+        memo_hits += struct_memo.m_hits;
+        memo_misses += struct_memo.m_misses;
+        memo_evictions += struct_memo.m_evictions;
+    };
+    vector<thread> threads;
+    for (unsigned i = 0; i < max(1u, jobs); i++)
+        threads.emplace_back(worker);
+
+    bool success = true;
+    for (size_t i = 0; i < names.size(); i++) {
+        EntryResult &result = results[i];
+        {
+            unique_lock<mutex> lock(results_mutex);
+            result_done.wait(lock, [&result]() { return result.done; });
+        }
+        fwrite(result.output.data(), 1, result.output.size(), stdout);
+        string errors = result.errors.str();
+        if (!errors.empty()) {
+            fflush(stdout);
+            cerr << "In " << names[i] << ":" << endl << errors;
+        }
+        success = success && result.success;
+        result.output = string();
+    }
+    for (thread &t : threads)
+        t.join();
+    fflush(stdout);
+
+    if (memo_capacity >= 0)
+        cerr << "Struct memo: " << memo_hits << " hits, " << memo_misses << " misses, " << memo_evictions << " evictions" << endl;
+    return success;
+}
+
+/// --zip: decodes the entries of an archive, in the order of the central directory. Each is inflated by the thread
+/// which decodes it.
+static bool decode_zip(const string &filename, const string &suffix, unsigned jobs, vector<upStatement> &statements,
+                       const vector<string> &lines, const InterpreterOptions &options, long memo_capacity) {
+    vector<uint8_t> archive;
+    if (!read_input_file(filename, archive)) {
+        cerr << "Failed to open input file" << endl;
+        return false;
+    }
+    vector<ZipEntry> all_entries;
+    string error;
+    if (!read_zip_directory(archive, all_entries, error)) {
+        cerr << filename << ": " << error << endl;
+        return false;
+    }
+    vector<ZipEntry> entries;
+    vector<string> names;
+    for (ZipEntry &entry : all_entries) {
+        if (!entry.is_directory() && entry.name.size() >= suffix.size() && entry.name.compare(entry.name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            names.push_back(entry.name);
+            entries.push_back(move(entry));
+        }
+    }
+
+    atomic<size_t> next_index(0);
+    auto next_entry = [&archive, &entries, &next_index](size_t &index, spInputData &data, string &entry_error) {
+        index = next_index++;
+        if (index >= entries.size())
+            return false;
+        data = make_shared<vector<uint8_t>>();
+        bool read;
+        try {
+            read = read_zip_entry(archive, entries[index], *data, entry_error);
+        } catch (exception &error) {
+            // an entry inflating to more than fits in memory
+            entry_error = string("Failed to read entry: ") + error.what();
+            read = false;
+        }
+        if (!read)
+            data = nullptr;
+        return true;
+    };
+    return decode_entries(names, next_entry, jobs, statements, lines, options, memo_capacity);
+}
+
+/// --dir: decodes every file in a directory, in name order. The files are read by a BatchReader on a thread of its own,
+/// which stops to wait once the decoders are read_ahead files behind.
+static bool decode_dir(const string &dir, unsigned jobs, unsigned queue_depth, bool io_stats, vector<upStatement> &statements,
+                       const vector<string> &lines, const InterpreterOptions &options, long memo_capacity) {
+    vector<string> names;
+    if (!list_directory_files(dir, names)) {
+        cerr << "Failed to open directory " << dir << endl;
+        return false;
+    }
+    vector<string> paths;
+    for (const string &name : names)
+        paths.push_back(dir + "/" + name);
+
+    struct ReadFile {
+        size_t index;
+        spInputData data;
+        string error;
+    };
+    const size_t read_ahead = 2 * static_cast<size_t>(queue_depth) + jobs;
+    deque<ReadFile> ready;
+    bool reading_done = false;
+    mutex ready_mutex;
+    condition_variable ready_changed;
+
+    BatchReader reader(paths, queue_depth);
+    thread reading([&]() {
+        reader.read_all([&](size_t index, spInputData data, const string &error) {
+            unique_lock<mutex> lock(ready_mutex);
+            ready_changed.wait(lock, [&]() { return ready.size() < read_ahead; });
+            ready.push_back({index, move(data), error});
+            ready_changed.notify_all();
+        });
+        lock_guard<mutex> lock(ready_mutex);
+        reading_done = true;
+        ready_changed.notify_all();
+    });
+
+    auto next_entry = [&](size_t &index, spInputData &data, string &error) {
+        unique_lock<mutex> lock(ready_mutex);
+        ready_changed.wait(lock, [&]() { return !ready.empty() || reading_done; });
+        if (ready.empty())
+            return false;
+        index = ready.front().index;
+        data = move(ready.front().data);
+        error = move(ready.front().error);
+        ready.pop_front();
+        ready_changed.notify_all();
+        return true;
+    };
+    bool success = decode_entries(names, next_entry, jobs, statements, lines, options, memo_capacity);
+    reading.join();
+
+    if (io_stats) {
+        BatchReaderStats &stats = reader.m_stats;
+        cerr << "Read " << stats.files << " files, " << stats.bytes << " bytes, with " << stats.queue_depth
+             << " threads, " << stats.syscalls << " system calls" << endl;
+    }
+    return success;
+}
+
 int main(int argc, char **argv) {
 
-    if (argc != 2) {
+    bool profile = false;
+    bool follow = false;
+    bool pipeline = false;
+    bool resume = false;
+    Compression compression = Compression::AUTO;
+    long checkpoint_every = 0;
+    string checkpoint_file;
+    long memo_capacity = -1;
+    string zip_file;
+    string zip_suffix;
+    string dir;
+    long queue_depth = 64;
+    bool io_stats = false;
+    long jobs = thread::hardware_concurrency();
+    unique_ptr<Selection> selection;
+    vector<char*> positional_args;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--profile") {
+            profile = true;
+        } else if (arg == "--follow") {
+            follow = true;
+        } else if (arg == "--pipeline") {
+            pipeline = true;
+        } else if (arg == "--zip" || arg == "--zip-suffix" || arg == "--dir") {
+            if (i + 1 == argc) {
+                cerr << arg << " needs a value" << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            (arg == "--zip" ? zip_file : arg == "--dir" ? dir : zip_suffix) = argv[++i];
+        } else if (arg == "--queue-depth") {
+            char *end = nullptr;
+            if (i + 1 < argc)
+                queue_depth = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || queue_depth <= 0 || queue_depth > 4096) {
+                cerr << "--queue-depth needs a number of files, up to 4096" << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--io-stats") {
+            io_stats = true;
+        } else if (arg == "-j") {
+            char *end = nullptr;
+            if (i + 1 < argc)
+                jobs = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || jobs <= 0) {
+                cerr << "-j needs a number of threads" << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--raw-deflate") {
+            compression = Compression::RAW_DEFLATE;
+        } else if (arg == "--no-decompress") {
+            compression = Compression::NONE;
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--checkpoint-every") {
+            char *end = nullptr;
+            if (i + 1 < argc)
+                checkpoint_every = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || checkpoint_every <= 0) {
+                cerr << "--checkpoint-every needs a number of statements" << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--checkpoint") {
+            if (i + 1 == argc) {
+                cerr << "--checkpoint needs a file name" << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            checkpoint_file = argv[++i];
+        } else if (arg == "--memo") {
+            char *end = nullptr;
+            if (i + 1 < argc)
+                memo_capacity = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || memo_capacity < 0) {
+                cerr << "--memo needs a number of structs" << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--select") {
+            if (i + 1 == argc) {
+                cerr << "--select needs a list of paths" << endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            try {
+                selection = make_unique<Selection>(argv[++i]);
+            } catch (string &error) {
+                cerr << error << endl;
+                return 1;
+            }
+        } else if (arg.compare(0, 2, "--") == 0) {
+            cerr << "Unknown option " << arg << endl;
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            positional_args.push_back(argv[i]);
+        }
+    }
+
+    bool many_inputs = !zip_file.empty() || !dir.empty();
+    if (positional_args.size() != (many_inputs ? 1 : 2)) {
         print_usage(argv[0]);
         return 0;
     }
+    if (!zip_file.empty() && !dir.empty()) {
+        cerr << "--zip and --dir can't be used together" << endl;
+        return 1;
+    }
+    if (many_inputs && (follow || profile || pipeline || checkpoint_every > 0 || resume)) {
+        cerr << "--follow, --profile, --pipeline, --checkpoint-every and --resume can't be used with --zip or --dir" << endl;
+        return 1;
+    }
 
-    ifstream infile(argv[1]);
+    ifstream infile(positional_args[0]);
     if (infile.fail()) {
-        cerr << "Failed to open input file" << endl;
+        cerr << "Failed to open binformat file" << endl;
+        return 1;
+    }
+
+    // what is appended to a followed file is decoded as it is
+    if (follow && compression == Compression::RAW_DEFLATE) {
+        cerr << "--follow can't be used with compressed input" << endl;
+        return 1;
+    }
+    if (follow)
+        compression = Compression::NONE;
+    auto input_data = make_shared<vector<uint8_t>>();
+    string input_error;
+    auto read_input = [&]() {
+        return many_inputs || read_compressed_input_file(positional_args[1], compression, *input_data, input_error);
+    };
+    // with --pipeline the input is read while the binformat is compiled, which the future waits for if it returns first
+    future<bool> pending_input;
+    if (pipeline) {
+        pending_input = async(launch::async, read_input);
+    } else if (!read_input()) {
+        cerr << input_error << endl;
         return 1;
     }
 
@@ -68,30 +519,67 @@ int main(int argc, char **argv) {
 
     vector<upStatement> statements;
 
-    parse(tokens, statements, [lines](Token t) {
+    if (!parse(tokens, statements, [lines](Token t) {
         cerr << lines[t.line - 1] << endl;
         cerr << create_underline(t) << endl;
         cerr << "Parsing error " << t.line << ":" << t.col << endl;
-    });
+    })) {
+        return 1;
+    }
 
-    execute(statements, [lines](string &error, vector<Statement*> &executing_statements, vector<Expression*> evaluating_expressions) {
-        Token begin_token, end_token;
-        if (evaluating_expressions.empty()) {
-            begin_token = executing_statements.back()->m_begin_token;
-            end_token = executing_statements.back()->m_end_token;
-        } else {
-            begin_token = evaluating_expressions.back()->m_begin_token;
-            end_token = evaluating_expressions.back()->m_end_token;
-        }
-        cerr << ":" << begin_token.line << ":" << begin_token.col << ": " << error << endl;
-        print_token_range(lines, begin_token, end_token, "");
-
-        auto it = executing_statements.rbegin();
-        if (evaluating_expressions.empty()) ++it;
-        for (; it != executing_statements.rend(); ++it) {
-            cerr << "  at :" << (*it)->m_begin_token.line << ":" << (*it)->m_begin_token.col << endl;
-            print_token_range(lines, (*it)->m_begin_token, (*it)->m_end_token, "    ");
+    compile(statements);
+    if (pipeline && !pending_input.get()) {
+        cerr << input_error << endl;
+        return 1;
+    }
+
+    Profiler profiler;
+    InterpreterOptions options;
+    if (profile)
+        options.profiler = &profiler;
+    StructMemo struct_memo(memo_capacity < 0 ? 0 : static_cast<size_t>(memo_capacity));
+    if (memo_capacity >= 0)
+        options.struct_memo = &struct_memo;
+    options.selection = selection.get();
+    if (checkpoint_every > 0 || resume) {
+        options.checkpoint_file = checkpoint_file.empty() ? string(positional_args[1]) + ".checkpoint" : checkpoint_file;
+        options.checkpoint_every = static_cast<uint64_t>(checkpoint_every);
+        options.resume = resume;
+    }
+    if (!zip_file.empty())
+        return decode_zip(zip_file, zip_suffix, static_cast<unsigned>(jobs), statements, lines, options, memo_capacity) ? 0 : 1;
+    if (!dir.empty())
+        return decode_dir(dir, static_cast<unsigned>(jobs), static_cast<unsigned>(queue_depth), io_stats, statements, lines, options, memo_capacity) ? 0 : 1;
+
+    FileFollower follower(positional_args[1]);
+    if (follow) {
+        string error;
+        if (!follower.open(error)) {
+            cerr << error << endl;
+            return 1;
         }
+        options.wait_for_input = [&follower](Input &input) { return follower.wait_for_input(input); };
+    }
+
+    unique_ptr<OutputWriter> output_writer;
+    if (pipeline) {
+        output_writer = make_unique<OutputWriter>(stdout, PIPELINE_DEPTH);
+        options.output_writer = output_writer.get();
+    }
+
+    bool success = execute(statements, Input(input_data), options, [&lines](string &error, vector<Statement*> &executing_statements, vector<Expression*> &evaluating_expressions) {
+        print_error(cerr, lines, error, executing_statements, evaluating_expressions);
     });
 
+    if (profile) {
+        print_profile(lines, profiler);
+        if (output_writer)
+            cerr << "Output writer: decoding waited for the output " << output_writer->m_stalls << " times" << endl;
+    }
+    if (options.struct_memo) {
+        cerr << "Struct memo: " << struct_memo.m_hits << " hits, " << struct_memo.m_misses << " misses, "
+             << struct_memo.m_evictions << " evictions, " << struct_memo.size() << " entries" << endl;
+    }
+
+    return success ? 0 : 1;
 }
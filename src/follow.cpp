@@ -0,0 +1,74 @@
+
+#include "follow.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+FileFollower::~FileFollower() {
+    if (m_fd >= 0)
+        close(m_fd);
+    if (m_inotify_fd >= 0)
+        close(m_inotify_fd);
+}
+
+bool FileFollower::open(string &error) {
+    m_fd = ::open(m_filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        error = "Failed to open " + m_filename + ": " + strerror(errno);
+        return false;
+    }
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd < 0 || inotify_add_watch(m_inotify_fd, m_filename.c_str(), IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+        error = "Failed to watch " + m_filename + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+size_t FileFollower::read_appended(Input &input) {
+    vector<uint8_t> &data = *input.data();
+    size_t total = 0;
+    uint8_t buf[65536];
+    while (true) {
+        ssize_t count = pread(m_fd, buf, sizeof(buf), static_cast<off_t>(data.size()));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return total;
+        data.insert(data.end(), buf, buf + count);
+        total += count;
+    }
+}
+
+bool FileFollower::wait_for_input(Input &input) {
+    if (read_appended(input) != 0)
+        return true;
+    while (!m_gone) {
+        // while we have it open a deleted file is only unlinked, which is an IN_ATTRIB
+        struct stat status;
+        if (fstat(m_fd, &status) != 0 || status.st_nlink == 0 || static_cast<uint64_t>(status.st_size) < input.data()->size())
+            return false;
+
+        alignas(inotify_event) char events[4096];
+        ssize_t length = read(m_inotify_fd, events, sizeof(events));
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length <= 0)
+            return false;
+        for (char *position = events; position < events + length;) {
+            auto event = reinterpret_cast<inotify_event*>(position);
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                m_gone = true;
+            position += sizeof(inotify_event) + event->len;
+        }
+        // a writer may have appended just before going away
+        if (read_appended(input) != 0)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,30 @@
+
+#ifndef DECODE_BIN_FOLLOW_H
+#define DECODE_BIN_FOLLOW_H
+
+#include <string>
+#include "input.h"
+
+/// Reads what is appended to a file as it grows, for --follow. Waits for changes with inotify rather than polling.
+class FileFollower {
+    std::string m_filename;
+    int m_fd = -1;
+    int m_inotify_fd = -1;
+    bool m_gone = false;
+
+    // appends anything new in the file to the input, returns the number of bytes read
+    size_t read_appended(Input &input);
+public:
+    explicit FileFollower(std::string filename) : m_filename(std::move(filename)) {}
+    ~FileFollower();
+    FileFollower(const FileFollower&) = delete;
+    FileFollower &operator=(const FileFollower&) = delete;
+
+    // returns false with a message if the file can't be watched
+    bool open(std::string &error);
+    // Blocks until more has been appended to the file, and appends it to the input. Returns false once the file has
+    // been deleted, moved or truncated, after reading whatever was left.
+    bool wait_for_input(Input &input);
+};
+
+#endif //DECODE_BIN_FOLLOW_H
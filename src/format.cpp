@@ -0,0 +1,405 @@
+
+#include "format.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+static const char DIGIT_PAIRS[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+void append_uint(string &out, uint64_t value) {
+    char buf[20];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    // two digits per division
+    while (value >= 100) {
+        unsigned pair = static_cast<unsigned>(value % 100) * 2;
+        value /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    if (value >= 10) {
+        unsigned pair = static_cast<unsigned>(value) * 2;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    } else {
+        *--p = static_cast<char>('0' + value);
+    }
+    out.append(p, end - p);
+}
+
+void append_int(string &out, int64_t value) {
+    if (value < 0) {
+        out += '-';
+        // negate as unsigned so that INT64_MIN works
+        append_uint(out, 0 - static_cast<uint64_t>(value));
+    } else {
+        append_uint(out, static_cast<uint64_t>(value));
+    }
+}
+
+void append_hex(string &out, uint64_t value) {
+    char buf[16];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    do {
+        *--p = HEX_DIGITS[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+    out.append(p, end - p);
+}
+
+static float parse_float(const char *str) { return strtof(str, nullptr); }
+static double parse_double(const char *str) { return strtod(str, nullptr); }
+
+namespace {
+/// f * 2^e, with more significand bits than any floating point type, for Grisu
+struct DiyFp {
+    uint64_t f;
+    int e;
+};
+
+struct CachedPower {
+    uint64_t significand;
+    int16_t binary_exponent;
+    int16_t decimal_exponent;
+};
+
+template<typename T> struct FloatBits;
+template<> struct FloatBits<float> {
+    typedef uint32_t Bits;
+    static const int SIGNIFICAND_BITS = 23;
+    // takes the significand as an integer too
+    static const int EXPONENT_BIAS = 127 + 23;
+};
+template<> struct FloatBits<double> {
+    typedef uint64_t Bits;
+    static const int SIGNIFICAND_BITS = 52;
+    static const int EXPONENT_BIAS = 1023 + 52;
+};
+}
+
+/// 10^d rounded to 64 significant bits, for every 8th d from -348 to 340
+static const CachedPower CACHED_POWERS[] = {
+        {0xfa8fd5a0081c0288, -1220, -348},
+        {0xbaaee17fa23ebf76, -1193, -340},
+        {0x8b16fb203055ac76, -1166, -332},
+        {0xcf42894a5dce35ea, -1140, -324},
+        {0x9a6bb0aa55653b2d, -1113, -316},
+        {0xe61acf033d1a45df, -1087, -308},
+        {0xab70fe17c79ac6ca, -1060, -300},
+        {0xff77b1fcbebcdc4f, -1034, -292},
+        {0xbe5691ef416bd60c, -1007, -284},
+        {0x8dd01fad907ffc3c, -980, -276},
+        {0xd3515c2831559a83, -954, -268},
+        {0x9d71ac8fada6c9b5, -927, -260},
+        {0xea9c227723ee8bcb, -901, -252},
+        {0xaecc49914078536d, -874, -244},
+        {0x823c12795db6ce57, -847, -236},
+        {0xc21094364dfb5637, -821, -228},
+        {0x9096ea6f3848984f, -794, -220},
+        {0xd77485cb25823ac7, -768, -212},
+        {0xa086cfcd97bf97f4, -741, -204},
+        {0xef340a98172aace5, -715, -196},
+        {0xb23867fb2a35b28e, -688, -188},
+        {0x84c8d4dfd2c63f3b, -661, -180},
+        {0xc5dd44271ad3cdba, -635, -172},
+        {0x936b9fcebb25c996, -608, -164},
+        {0xdbac6c247d62a584, -582, -156},
+        {0xa3ab66580d5fdaf6, -555, -148},
+        {0xf3e2f893dec3f126, -529, -140},
+        {0xb5b5ada8aaff80b8, -502, -132},
+        {0x87625f056c7c4a8b, -475, -124},
+        {0xc9bcff6034c13053, -449, -116},
+        {0x964e858c91ba2655, -422, -108},
+        {0xdff9772470297ebd, -396, -100},
+        {0xa6dfbd9fb8e5b88f, -369, -92},
+        {0xf8a95fcf88747d94, -343, -84},
+        {0xb94470938fa89bcf, -316, -76},
+        {0x8a08f0f8bf0f156b, -289, -68},
+        {0xcdb02555653131b6, -263, -60},
+        {0x993fe2c6d07b7fac, -236, -52},
+        {0xe45c10c42a2b3b06, -210, -44},
+        {0xaa242499697392d3, -183, -36},
+        {0xfd87b5f28300ca0e, -157, -28},
+        {0xbce5086492111aeb, -130, -20},
+        {0x8cbccc096f5088cc, -103, -12},
+        {0xd1b71758e219652c, -77, -4},
+        {0x9c40000000000000, -50, 4},
+        {0xe8d4a51000000000, -24, 12},
+        {0xad78ebc5ac620000, 3, 20},
+        {0x813f3978f8940984, 30, 28},
+        {0xc097ce7bc90715b3, 56, 36},
+        {0x8f7e32ce7bea5c70, 83, 44},
+        {0xd5d238a4abe98068, 109, 52},
+        {0x9f4f2726179a2245, 136, 60},
+        {0xed63a231d4c4fb27, 162, 68},
+        {0xb0de65388cc8ada8, 189, 76},
+        {0x83c7088e1aab65db, 216, 84},
+        {0xc45d1df942711d9a, 242, 92},
+        {0x924d692ca61be758, 269, 100},
+        {0xda01ee641a708dea, 295, 108},
+        {0xa26da3999aef774a, 322, 116},
+        {0xf209787bb47d6b85, 348, 124},
+        {0xb454e4a179dd1877, 375, 132},
+        {0x865b86925b9bc5c2, 402, 140},
+        {0xc83553c5c8965d3d, 428, 148},
+        {0x952ab45cfa97a0b3, 455, 156},
+        {0xde469fbd99a05fe3, 481, 164},
+        {0xa59bc234db398c25, 508, 172},
+        {0xf6c69a72a3989f5c, 534, 180},
+        {0xb7dcbf5354e9bece, 561, 188},
+        {0x88fcf317f22241e2, 588, 196},
+        {0xcc20ce9bd35c78a5, 614, 204},
+        {0x98165af37b2153df, 641, 212},
+        {0xe2a0b5dc971f303a, 667, 220},
+        {0xa8d9d1535ce3b396, 694, 228},
+        {0xfb9b7cd9a4a7443c, 720, 236},
+        {0xbb764c4ca7a44410, 747, 244},
+        {0x8bab8eefb6409c1a, 774, 252},
+        {0xd01fef10a657842c, 800, 260},
+        {0x9b10a4e5e9913129, 827, 268},
+        {0xe7109bfba19c0c9d, 853, 276},
+        {0xac2820d9623bf429, 880, 284},
+        {0x80444b5e7aa7cf85, 907, 292},
+        {0xbf21e44003acdd2d, 933, 300},
+        {0x8e679c2f5e44ff8f, 960, 308},
+        {0xd433179d9c8cb841, 986, 316},
+        {0x9e19db92b4e31ba9, 1013, 324},
+        {0xeb96bf6ebadf77d9, 1039, 332},
+        {0xaf87023b9bf0ee6b, 1066, 340},
+};
+static const int CACHED_POWERS_OFFSET = 348;
+static const int CACHED_POWERS_STEP = 8;
+
+static DiyFp normalize(DiyFp value) {
+    int shift = __builtin_clzll(value.f);
+    return {value.f << shift, value.e - shift};
+}
+
+/// The top 64 bits of the product, rounded
+static DiyFp multiply(DiyFp a, DiyFp b) {
+    const uint64_t M32 = 0xffffffff;
+    uint64_t ac = (a.f >> 32) * (b.f >> 32);
+    uint64_t bc = (a.f & M32) * (b.f >> 32);
+    uint64_t ad = (a.f >> 32) * (b.f & M32);
+    uint64_t bd = (a.f & M32) * (b.f & M32);
+    uint64_t middle = (bd >> 32) + (ad & M32) + (bc & M32) + (1u << 31);
+    return {ac + (ad >> 32) + (bc >> 32) + (middle >> 32), a.e + b.e + 64};
+}
+
+/// Moves the last digit down towards w while that gets closer to it, and then checks that the result is certainly the
+/// closest shortest representation despite the imprecision of everything being scaled. All of the distances are in
+/// units of the scaled values, with unit the possible error in them.
+static bool round_weed(char *digits, int num_digits, uint64_t distance_too_high_w, uint64_t unsafe_interval,
+                       uint64_t rest, uint64_t ten_kappa, uint64_t unit) {
+    uint64_t small_distance = distance_too_high_w - unit;
+    uint64_t big_distance = distance_too_high_w + unit;
+    while (rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+           (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)) {
+        digits[num_digits - 1]--;
+        rest += ten_kappa;
+    }
+    // if w could be closer to the next one down, we can't tell which is right
+    if (rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance))
+        return false;
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+/// Grisu3, from "Printing Floating-Point Numbers Quickly and Accurately with Integers" by Florian Loitsch. Finds the
+/// shortest digits which are in the rounding interval of value, using only 64 bit integers, so value is
+/// digits * 10^exponent. Returns false in the rare cases where the imprecision of that means it can't be sure the
+/// digits are the shortest and closest, and then they have to be found the slow way.
+template<typename T>
+static bool grisu3(T value, char *digits, int &num_digits, int &exponent) {
+    typedef FloatBits<T> Traits;
+    typename Traits::Bits bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t fraction = bits & ((typename Traits::Bits(1) << Traits::SIGNIFICAND_BITS) - 1);
+    int biased_exponent = static_cast<int>(bits >> Traits::SIGNIFICAND_BITS);
+    DiyFp v = biased_exponent == 0
+              ? DiyFp{fraction, 1 - Traits::EXPONENT_BIAS}
+              : DiyFp{fraction | uint64_t(1) << Traits::SIGNIFICAND_BITS, biased_exponent - Traits::EXPONENT_BIAS};
+
+    // Anything between the boundaries halfway to the neighbouring values parses back to value. The one below is
+    // closer when value is a power of two, since the exponent goes down by one there.
+    DiyFp high = normalize({(v.f << 1) + 1, v.e - 1});
+    DiyFp low = fraction == 0 && biased_exponent > 1 ? DiyFp{(v.f << 2) - 1, v.e - 2} : DiyFp{(v.f << 1) - 1, v.e - 1};
+    low = {low.f << (low.e - high.e), high.e};
+    DiyFp w = normalize(v);
+
+    // scale by a power of ten which leaves the binary exponent in [-60, -32], so the integral part fits in 32 bits
+    int min_exponent = -60 - (w.e + 64);
+    int k = static_cast<int>(ceil((min_exponent + 63) * 0.30102999566398114));
+    const CachedPower &power = CACHED_POWERS[(CACHED_POWERS_OFFSET + k - 1) / CACHED_POWERS_STEP + 1];
+    DiyFp scale = {power.significand, power.binary_exponent};
+    w = multiply(w, scale);
+    low = multiply(low, scale);
+    high = multiply(high, scale);
+
+    // each of the scaled values is within one unit of the exact one, so only what's inside both is safe
+    uint64_t unit = 1;
+    DiyFp too_low = {low.f - unit, low.e};
+    DiyFp too_high = {high.f + unit, high.e};
+    uint64_t unsafe_interval = too_high.f - too_low.f;
+    int shift = -w.e;
+    uint64_t one = uint64_t(1) << shift;
+    uint32_t integrals = static_cast<uint32_t>(too_high.f >> shift);
+    uint64_t fractionals = too_high.f & (one - 1);
+
+    uint32_t divisor = 0;
+    int kappa = 0;
+    if (integrals != 0) {
+        divisor = 1;
+        kappa = 1;
+        while (uint64_t(divisor) * 10 <= integrals) {
+            divisor *= 10;
+            kappa++;
+        }
+    }
+    num_digits = 0;
+    while (kappa > 0) {
+        digits[num_digits++] = static_cast<char>('0' + integrals / divisor);
+        integrals %= divisor;
+        kappa--;
+        uint64_t rest = (uint64_t(integrals) << shift) + fractionals;
+        if (rest < unsafe_interval) {
+            exponent = kappa - power.decimal_exponent;
+            return round_weed(digits, num_digits, too_high.f - w.f, unsafe_interval, rest,
+                              uint64_t(divisor) << shift, unit);
+        }
+        divisor /= 10;
+    }
+    while (true) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+        digits[num_digits++] = static_cast<char>('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        kappa--;
+        if (fractionals < unsafe_interval) {
+            exponent = kappa - power.decimal_exponent;
+            return round_weed(digits, num_digits, (too_high.f - w.f) * unit, unsafe_interval, fractionals, one, unit);
+        }
+    }
+}
+
+/// Finds the fewest significant digits which parse back to the same value, so value is d.ddd * 10^exponent. Printing
+/// more digits only gets closer to the exact value, so we can bisect rather than trying every precision in turn. The
+/// C library does the correctly rounded digit generation for us.
+template<typename T>
+static void shortest_digits_slow(T value, int max_digits, T (*parse)(const char*), char *digits, int &num_digits,
+                                 int &exponent) {
+    char buf[32];
+    int lo = 1, hi = max_digits;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        snprintf(buf, sizeof(buf), "%.*e", mid - 1, static_cast<double>(value));
+        if (parse(buf) == value)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    snprintf(buf, sizeof(buf), "%.*e", lo - 1, static_cast<double>(value));
+
+    // buf is now d[.ddd]e[+-]xx. Don't assume that the decimal point is a '.', it depends on the locale.
+    num_digits = 0;
+    const char *p = buf;
+    for (; *p != 'e'; p++) {
+        if (*p >= '0' && *p <= '9')
+            digits[num_digits++] = *p;
+    }
+    exponent = atoi(p + 1);
+}
+
+/// Lays out the significant digits with the given decimal exponent (of the first digit), in plain notation if
+/// the exponent is reasonable and in scientific notation otherwise. Always has a decimal point, so that floating
+/// point values are distinguishable from integers.
+static void append_digits(string &out, const char *digits, int num_digits, int exponent) {
+    if (exponent >= 0 && exponent < 16) {
+        if (num_digits <= exponent + 1) {
+            out.append(digits, num_digits);
+            out.append(exponent + 1 - num_digits, '0');
+            out += ".0";
+        } else {
+            out.append(digits, exponent + 1);
+            out += '.';
+            out.append(digits + exponent + 1, num_digits - exponent - 1);
+        }
+    } else if (exponent < 0 && exponent >= -5) {
+        out += "0.";
+        out.append(-exponent - 1, '0');
+        out.append(digits, num_digits);
+    } else {
+        out += digits[0];
+        out += '.';
+        if (num_digits == 1)
+            out += '0';
+        else
+            out.append(digits + 1, num_digits - 1);
+        out += 'e';
+        append_int(out, exponent);
+    }
+}
+
+template<typename T>
+static void append_floating_point(string &out, T value, int max_digits, T (*parse)(const char*)) {
+    if (std::isnan(value)) {
+        out += "NaN";
+        return;
+    }
+    if (std::signbit(value)) {
+        out += '-';
+        value = -value;
+    }
+    if (std::isinf(value)) {
+        out += "Infinity";
+        return;
+    }
+    if (value == 0) {
+        out += "0.0";
+        return;
+    }
+
+    // Fast path: integral values which are exactly representable as an int64_t. These are exactly their integer
+    // text, which is also the shortest round trip representation.
+    if (value < T(9007199254740992.0) && value == std::trunc(value)) {
+        append_uint(out, static_cast<uint64_t>(value));
+        out += ".0";
+        return;
+    }
+
+    char digits[20];
+    int num_digits, exponent;
+    if (grisu3(value, digits, num_digits, exponent))
+        exponent += num_digits - 1;
+    else
+        shortest_digits_slow(value, max_digits, parse, digits, num_digits, exponent);
+    while (num_digits > 1 && digits[num_digits - 1] == '0')
+        num_digits--;
+
+    append_digits(out, digits, num_digits, exponent);
+}
+
+void append_float(string &out, float value) {
+    append_floating_point<float>(out, value, 9, parse_float);
+}
+
+void append_double(string &out, double value) {
+    append_floating_point<double>(out, value, 17, parse_double);
+}
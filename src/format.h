@@ -0,0 +1,20 @@
+
+#ifndef DECODE_BIN_FORMAT_H
+#define DECODE_BIN_FORMAT_H
+
+#include <cstdint>
+#include <string>
+
+// All of these append to the end of out rather than returning a new string,
+// so that callers can build up a whole line in one buffer.
+
+void append_int(std::string &out, int64_t value);
+void append_uint(std::string &out, uint64_t value);
+// lower case, no 0x prefix
+void append_hex(std::string &out, uint64_t value);
+
+// Shortest representation which parses back to exactly the same value
+void append_float(std::string &out, float value);
+void append_double(std::string &out, double value);
+
+#endif //DECODE_BIN_FORMAT_H
@@ -0,0 +1,137 @@
+
+#include "input.h"
+#include <algorithm>
+#include <cstdio>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+const uint8_t *Input::read(size_t count) {
+    align();
+    if (count > remaining())
+        throw "Unexpected end of input at offset " + to_string(m_offset) + ", needed " + to_string(count) + " bytes but only " + to_string(remaining()) + " remain";
+    const uint8_t *ret = m_data->data() + m_offset;
+    m_offset += count;
+    return ret;
+}
+
+uint64_t Input::read_uint(int size, ByteOrder byte_order) {
+    const uint8_t *bytes = read(size);
+    uint64_t value = 0;
+    if (byte_order == ByteOrder::BIG) {
+        for (int i = 0; i < size; i++)
+            value = (value << 8) | bytes[i];
+    } else {
+        for (int i = size - 1; i >= 0; i--)
+            value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+/// Assembled byte by byte so it doesn't depend on the host byte order, compilers turn the full word into one load
+void Input::load_word(ByteOrder byte_order) {
+    m_word_offset = m_offset;
+    m_word_bytes = std::min<size_t>(8, m_data->size() - m_offset);
+    m_word_byte_order = byte_order;
+    const uint8_t *bytes = m_data->data() + m_offset;
+    m_word = 0;
+    if (m_word_bytes == 8) {
+        if (byte_order == ByteOrder::BIG) {
+            for (int i = 0; i < 8; i++)
+                m_word = (m_word << 8) | bytes[i];
+        } else {
+            for (int i = 7; i >= 0; i--)
+                m_word = (m_word << 8) | bytes[i];
+        }
+        return;
+    }
+    // near the end, the missing bytes are zeros
+    for (size_t i = 0; i < m_word_bytes; i++) {
+        int shift = byte_order == ByteOrder::BIG ? 56 - 8 * static_cast<int>(i) : 8 * static_cast<int>(i);
+        m_word |= static_cast<uint64_t>(bytes[i]) << shift;
+    }
+}
+
+uint64_t Input::read_bits(int count, ByteOrder byte_order) {
+    // more than 56 bits may not fit in a word that starts part way through a byte
+    if (count > 56) {
+        if (byte_order == ByteOrder::BIG) {
+            uint64_t high = read_bits(count - 32, byte_order);
+            return (high << 32) | read_bits(32, byte_order);
+        }
+        uint64_t low = read_bits(32, byte_order);
+        return low | (read_bits(count - 32, byte_order) << 32);
+    }
+
+    if (m_word_bytes == 0 || m_word_byte_order != byte_order || m_offset < m_word_offset ||
+        (m_offset - m_word_offset) * 8 + m_bit_offset + count > m_word_bytes * 8)
+        load_word(byte_order);
+    size_t position = (m_offset - m_word_offset) * 8 + m_bit_offset;
+    uint64_t value;
+    if (byte_order == ByteOrder::BIG)
+        value = (m_word << position) >> (64 - count);
+    else
+        value = (m_word >> position) & (~uint64_t(0) >> (64 - count));
+    position += count;
+    m_offset = m_word_offset + position / 8;
+    m_bit_offset = static_cast<int>(position % 8);
+    return value;
+}
+
+/// Gathers the low 7 bits of each byte of word into one number
+static uint64_t compact_leb128(uint64_t word) {
+#ifdef __BMI2__
+    return _pext_u64(word, 0x7f7f7f7f7f7f7f7f);
+#else
+    // halve the number of groups each step: 7 bits in 8, then 14 in 16, 28 in 32 and 56 in 64
+    word &= 0x7f7f7f7f7f7f7f7f;
+    word = ((word & 0x7f007f007f007f00) >> 1) | (word & 0x007f007f007f007f);
+    word = ((word & 0x3fff00003fff0000) >> 2) | (word & 0x00003fff00003fff);
+    return ((word & 0x0fffffff00000000) >> 4) | (word & 0x000000000fffffff);
+#endif
+}
+
+size_t Input::peek_leb128(size_t max_bytes, uint64_t &value) {
+    size_t start = offset();
+    size_t available = std::min(max_bytes, m_data->size() - start);
+    const uint8_t *bytes = m_data->data() + start;
+
+    // usually the last byte is in the next 8, which can be found and decoded without a loop
+    if (m_data->size() - start >= 8) {
+        uint64_t word = 0;
+        for (int i = 7; i >= 0; i--)
+            word = (word << 8) | bytes[i];
+        uint64_t ends = ~word & 0x8080808080808080;
+        if (ends != 0) {
+            size_t length = static_cast<size_t>(__builtin_ctzll(ends)) / 8 + 1;
+            if (length <= max_bytes) {
+                uint64_t last_bit = ends & (0 - ends);
+                value = compact_leb128(word & (last_bit | (last_bit - 1)));
+                return length;
+            }
+        }
+    }
+
+    value = 0;
+    for (size_t i = 0; i < available; i++) {
+        value |= static_cast<uint64_t>(bytes[i] & 0x7f) << (7 * i);
+        if ((bytes[i] & 0x80) == 0)
+            return i + 1;
+    }
+    return 0;
+}
+
+bool read_input_file(const string &filename, vector<uint8_t> &data) {
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file)
+        return false;
+    uint8_t buf[65536];
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), file)) != 0)
+        data.insert(data.end(), buf, buf + count);
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
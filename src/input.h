@@ -0,0 +1,63 @@
+
+#ifndef DECODE_BIN_INPUT_H
+#define DECODE_BIN_INPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class ByteOrder {
+    LITTLE, BIG
+};
+
+typedef std::shared_ptr<std::vector<uint8_t>> spInputData;
+
+/// The binary data being decoded, and the position we are currently reading from.
+/// Values may keep a reference to the data (see BytesRuntimeValue), so it is shared rather than owned.
+/// The position can be part way through a byte after reading bit fields, anything else starts at the next whole byte.
+class Input {
+    spInputData m_data;
+    size_t m_offset = 0;
+    // bits of the byte at m_offset which have already been read
+    int m_bit_offset = 0;
+    // Bit fields are read from a word of up to 8 bytes starting at m_word_offset, so a run of them only loads it once.
+    // The data is only ever appended to, so the word stays valid; m_word_bytes is 0 before anything is loaded.
+    uint64_t m_word = 0;
+    size_t m_word_offset = 0;
+    size_t m_word_bytes = 0;
+    ByteOrder m_word_byte_order = ByteOrder::LITTLE;
+
+    void load_word(ByteOrder byte_order);
+public:
+    Input() : m_data(std::make_shared<std::vector<uint8_t>>()) {}
+    explicit Input(spInputData data) : m_data(std::move(data)) {}
+
+    spInputData &data() { return m_data; }
+    // where the next whole byte starts
+    size_t offset() { return m_offset + (m_bit_offset != 0); }
+    void seek(size_t offset) { m_offset = offset; m_bit_offset = 0; }
+    size_t remaining() { return m_data->size() - offset(); }
+    // the exact position including bits, for going back to it later
+    uint64_t bit_position() { return static_cast<uint64_t>(m_offset) * 8 + m_bit_offset; }
+    void seek_bits(uint64_t position) { m_offset = static_cast<size_t>(position / 8); m_bit_offset = static_cast<int>(position % 8); }
+    uint64_t remaining_bits() { return static_cast<uint64_t>(m_data->size() - m_offset) * 8 - m_bit_offset; }
+    // skips the rest of a partly read byte
+    void align() { m_offset = offset(); m_bit_offset = 0; }
+
+    // returns a pointer to the next count bytes and advances past them, throws if there are not enough bytes left
+    const uint8_t *read(size_t count);
+    uint64_t read_uint(int size, ByteOrder byte_order);
+    // Reads count (1 to 64) bits, which the caller has checked are there. Big endian takes them from the most
+    // significant bit of each byte first, little endian from the least significant, as the byte orders do for bytes.
+    uint64_t read_bits(int count, ByteOrder byte_order);
+    // Decodes LEB128 (7 bits a byte, least significant first, with the top bit set on every byte but the last) from
+    // the next whole byte, taking at most max_bytes (up to 10). Returns how many bytes it took without moving past
+    // them, or 0 if none of the first max_bytes ended it, including when the input ends first.
+    size_t peek_leb128(size_t max_bytes, uint64_t &value);
+};
+
+bool read_input_file(const std::string &filename, std::vector<uint8_t> &data);
+
+#endif //DECODE_BIN_INPUT_H
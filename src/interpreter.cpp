@@ -1,8 +1,14 @@
 
 #include "interpreter.h"
 #include "ast.h"
-#include <sstream>
+#include "checkpoint.h"
+#include "output_writer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -37,80 +43,683 @@ AssignmentOperator get_assignment_operator(string op) {
     return nullptr;
 }
 
-string ArrayRuntimeValue::to_string() {
-    stringstream ret;
-    ret << "[";
-    int i;
+// C++ gives int op int an int, and long op int or long a long, so those are the ones which keep the left type
+#define IN_PLACE_OP(op_) [](RuntimeValue &left, RuntimeValue &right) { \
+    if (left.m_type == RuntimeType::INT && right.m_type == RuntimeType::INT) { \
+        int32_t &value = static_cast<IntegerRuntimeValue&>(left).m_value; \
+        value = value op_ static_cast<IntegerRuntimeValue&>(right).m_value; \
+        return true; \
+    } \
+    if (left.m_type == RuntimeType::LONG && (right.m_type == RuntimeType::LONG || right.m_type == RuntimeType::INT)) { \
+        int64_t &value = static_cast<LongRuntimeValue&>(left).m_value; \
+        value = value op_ (right.m_type == RuntimeType::LONG ? static_cast<LongRuntimeValue&>(right).m_value : static_cast<IntegerRuntimeValue&>(right).m_value); \
+        return true; \
+    } \
+    return false; \
+}
+
+InPlaceOperator get_in_place_operator(const string &op) {
+    // / and % are left to the generic operators
+    if (op == "+=") return IN_PLACE_OP(+);
+    if (op == "-=") return IN_PLACE_OP(-);
+    if (op == "*=") return IN_PLACE_OP(*);
+    if (op == "&=") return IN_PLACE_OP(&);
+    if (op == "|=") return IN_PLACE_OP(|);
+    if (op == "^=") return IN_PLACE_OP(^);
+    if (op == "<<=") return IN_PLACE_OP(<<);
+    if (op == ">>=") return IN_PLACE_OP(>>);
+    return nullptr;
+}
+#undef IN_PLACE_OP
+
+bool increment_in_place(RuntimeValue &value, int delta) {
+    if (value.m_type == RuntimeType::INT) {
+        static_cast<IntegerRuntimeValue&>(value).m_value += delta;
+        return true;
+    }
+    if (value.m_type == RuntimeType::LONG) {
+        static_cast<LongRuntimeValue&>(value).m_value += delta;
+        return true;
+    }
+    return false;
+}
+
+template<typename T>
+static inline T basic_value(RuntimeValue &value) {
+    return static_cast<typename BasicRuntimeType<T>::type&>(value).m_value;
+}
+
+// The same expressions as the generic operators in interpreter.tpp, so the results are the same, with the types
+// known rather than looked up
+#define TYPED_BINARY_OP(op_, name_) template<typename L, typename R> \
+struct typed_##name_ { \
+    typedef decltype(declval<L>() op_ declval<R>()) result_type; \
+    static spRuntimeValue apply(RuntimeValue &left, RuntimeValue &right) { \
+        return make_basic_value(basic_value<L>(left) op_ basic_value<R>(right)); \
+    } \
+    static spRuntimeValue generic(RuntimeValue &left, RuntimeValue &right) { return left op_ right; } \
+};
+TYPED_BINARY_OP(+, add)
+TYPED_BINARY_OP(-, sub)
+TYPED_BINARY_OP(*, mul)
+TYPED_BINARY_OP(/, div)
+TYPED_BINARY_OP(%, mod)
+TYPED_BINARY_OP(&, and)
+TYPED_BINARY_OP(|, or)
+TYPED_BINARY_OP(^, xor)
+TYPED_BINARY_OP(<<, left_shift)
+TYPED_BINARY_OP(>>, right_shift)
+TYPED_BINARY_OP(&&, logical_and)
+TYPED_BINARY_OP(||, logical_or)
+TYPED_BINARY_OP(==, eq)
+TYPED_BINARY_OP(!=, ne)
+TYPED_BINARY_OP(<, lt)
+TYPED_BINARY_OP(>, gt)
+TYPED_BINARY_OP(<=, le)
+TYPED_BINARY_OP(>=, ge)
+#undef TYPED_BINARY_OP
+
+#define TYPED_UNARY_OP(op_, name_) template<typename T> \
+struct typed_##name_ { \
+    typedef decltype(op_ declval<T>()) result_type; \
+    static spRuntimeValue apply(RuntimeValue &operand) { return make_basic_value(op_ basic_value<T>(operand)); } \
+    static spRuntimeValue generic(RuntimeValue &operand) { return op_ operand; } \
+};
+TYPED_UNARY_OP(+, plus)
+TYPED_UNARY_OP(-, minus)
+TYPED_UNARY_OP(!, not)
+TYPED_UNARY_OP(~, bitnot)
+#undef TYPED_UNARY_OP
+
+#define TYPED_OP(op_, name_) if (op == #op_) \
+    return {typed_##name_<L, R>::apply, typed_##name_<L, R>::generic, BasicRuntimeType<L>::runtime_type, \
+            BasicRuntimeType<R>::runtime_type, BasicRuntimeType<typename typed_##name_<L, R>::result_type>::runtime_type};
+
+template<typename L, typename R>
+static TypedBinaryOperator typed_logical_operator(const string &op) {
+    TYPED_OP(&&, logical_and)
+    TYPED_OP(||, logical_or)
+    TYPED_OP(==, eq)
+    TYPED_OP(!=, ne)
+    return {};
+}
+
+template<typename L, typename R>
+static TypedBinaryOperator typed_integer_operator(const string &op) {
+    TYPED_OP(+, add)
+    TYPED_OP(-, sub)
+    TYPED_OP(*, mul)
+    TYPED_OP(/, div)
+    TYPED_OP(%, mod)
+    TYPED_OP(&, and)
+    TYPED_OP(|, or)
+    TYPED_OP(^, xor)
+    TYPED_OP(<<, left_shift)
+    TYPED_OP(>>, right_shift)
+    TYPED_OP(<, lt)
+    TYPED_OP(>, gt)
+    TYPED_OP(<=, le)
+    TYPED_OP(>=, ge)
+    return typed_logical_operator<L, R>(op);
+}
+#undef TYPED_OP
+
+TypedBinaryOperator get_typed_binary_operator(const string &op, RuntimeType left, RuntimeType right) {
+    if (left == RuntimeType::INT && right == RuntimeType::INT)
+        return typed_integer_operator<int32_t, int32_t>(op);
+    if (left == RuntimeType::INT && right == RuntimeType::LONG)
+        return typed_integer_operator<int32_t, int64_t>(op);
+    if (left == RuntimeType::LONG && right == RuntimeType::INT)
+        return typed_integer_operator<int64_t, int32_t>(op);
+    if (left == RuntimeType::LONG && right == RuntimeType::LONG)
+        return typed_integer_operator<int64_t, int64_t>(op);
+    if (left == RuntimeType::BOOLEAN && right == RuntimeType::BOOLEAN)
+        return typed_logical_operator<bool, bool>(op);
+    return {};
+}
+
+#define TYPED_OP(op_, name_) if (op == #op_) \
+    return {typed_##name_<T>::apply, typed_##name_<T>::generic, BasicRuntimeType<T>::runtime_type, \
+            BasicRuntimeType<typename typed_##name_<T>::result_type>::runtime_type};
+
+template<typename T>
+static TypedUnaryOperator typed_integer_operator(const string &op) {
+    TYPED_OP(+, plus)
+    TYPED_OP(-, minus)
+    TYPED_OP(!, not)
+    TYPED_OP(~, bitnot)
+    return {};
+}
+#undef TYPED_OP
+
+TypedUnaryOperator get_typed_unary_operator(const string &op, RuntimeType operand) {
+    if (operand == RuntimeType::INT)
+        return typed_integer_operator<int32_t>(op);
+    if (operand == RuntimeType::LONG)
+        return typed_integer_operator<int64_t>(op);
+    if (operand == RuntimeType::BOOLEAN && op == "!")
+        return {typed_not<bool>::apply, typed_not<bool>::generic, RuntimeType::BOOLEAN, RuntimeType::BOOLEAN};
+    return {};
+}
+
+void ArrayRuntimeValue::append_to(string &out) {
+    out += '[';
+    size_t i;
     for (i = 0; i < m_values->size() && i < 5; i++) {
         if (i != 0)
-            ret << ", ";
-        ret << (*m_values)[i]->to_string();
+            out += ", ";
+        (*m_values)[i]->append_to(out);
     }
     if (i < m_values->size()) {
-        ret << ", ... (" << (m_values->size() - i) << " more)";
+        out += ", ... (";
+        append_uint(out, m_values->size() - i);
+        out += " more)";
     }
-    ret << "]";
-    return ret.str();
+    out += ']';
 }
 
-string StructRuntimeValue::to_string() {
-    stringstream ret;
-    ret << "{";
+void StructRuntimeValue::append_to(string &out) {
+    out += '{';
     int count = 0;
     std::map<std::string, spRuntimeValue>::iterator it;
     for (it = m_values->begin(); it != m_values->end(); ++it) {
         if (count != 0)
-            ret << ", ";
-        ret << it->first << " = " << it->second->to_string();
+            out += ", ";
+        out += it->first;
+        out += " = ";
+        it->second->append_to(out);
         count++;
         if (count == 5)
             break;
     }
     if (it != m_values->end()) {
-        ret << ", ... (" << (m_values->size() - count) << " more)";
+        out += ", ... (";
+        append_uint(out, m_values->size() - count);
+        out += " more)";
+    }
+    out += '}';
+}
+
+void BytesRuntimeValue::append_to(string &out) {
+    out += '[';
+    size_t i;
+    for (i = 0; i < m_length && i < 5; i++) {
+        if (i != 0)
+            out += ", ";
+        uint8_t byte = bytes()[i];
+        append_int(out, m_signed ? static_cast<int8_t>(byte) : byte);
+    }
+    if (i < m_length) {
+        out += ", ... (";
+        append_uint(out, m_length - i);
+        out += " more)";
     }
-    ret << "}";
-    return ret.str();
+    out += ']';
+}
+
+spRuntimeValue StringRuntimeValue::operator+(RuntimeValue &right) {
+    auto ret = make_shared<StringRuntimeValue>(m_value);
+    right.append_to(ret->m_value);
+    return ret;
+}
+
+spRuntimeValue StringRuntimeValue::operator==(RuntimeValue &right) {
+    return make_shared<BooleanRuntimeValue>(right.m_type == RuntimeType::STRING && dynamic_cast<StringRuntimeValue&>(right).m_value == m_value);
+}
+
+spRuntimeValue StringRuntimeValue::operator!=(RuntimeValue &right) {
+    return make_shared<BooleanRuntimeValue>(right.m_type != RuntimeType::STRING || dynamic_cast<StringRuntimeValue&>(right).m_value != m_value);
 }
 
 void InterpreterContext::execute_statement(Statement &statement) {
-    executing_statements.push_back(&statement);
-    statement.execute(*this);
-    if (is_broken() || is_continued()) {
-        executing_statements_to_remove++;
-    } else {
-        executing_statements.pop_back();
+    try {
+        if (m_profiler) {
+            m_profiler->begin(m_input.offset());
+            statement.execute(*this);
+            m_profiler->end(m_profiler->m_statements[&statement], m_input.offset());
+        } else {
+            statement.execute(*this);
+        }
+    } catch (...) {
+        m_error_statements.push_back(&statement);
+        throw;
     }
+    if (is_broken() || is_continued())
+        m_broken_statements.push_back(&statement);
 }
 
 spRuntimeValue InterpreterContext::evaluate_expression(Expression &expression) {
-    evaluating_expressions.push_back(&expression);
-    auto ret = expression.evaluate(*this);
-    evaluating_expressions.pop_back();
+    try {
+        return expression.evaluate(*this);
+    } catch (...) {
+        m_error_expressions.push_back(&expression);
+        throw;
+    }
+}
+
+spRuntimeValue InterpreterContext::execute_struct(Struct &type, spStructRuntimeValue &runtime_value) {
+    // only things that decode to a struct value are worth looking up, primitives are quicker to read again
+    // struct refs on a selected path output differently depending on what's in them, so can't be replayed
+    if (m_struct_memo && type.m_closed && runtime_value && !m_struct_refs.back().on_path)
+        return execute_struct_memoized(type, runtime_value);
+    return execute_struct_profiled(type, runtime_value);
+}
+
+/// A closed struct decodes the same way every time it starts at the same place with the same byte order, so a hit
+/// replays what it did: where the input and byte order ended up, and what it output.
+spRuntimeValue InterpreterContext::execute_struct_memoized(Struct &type, spStructRuntimeValue &runtime_value) {
+    StructMemo::Key key = make_tuple(&type, m_input.bit_position(), m_byte_order);
+    bool hidden = m_struct_refs.back().hidden;
+    StructMemoEntry *entry = m_struct_memo->find(key);
+    if (entry && entry->hidden == hidden && entry->output_depth == m_output_depth) {
+        m_struct_memo->m_hits++;
+        m_array_index = nullptr;
+        m_input.seek_bits(entry->end_position);
+        m_byte_order = entry->end_byte_order;
+        m_output += entry->output;
+        m_output_line_start = entry->output_line_start;
+        return entry->value;
+    }
+
+    m_struct_memo->m_misses++;
+    size_t output_start = m_output.size();
+    uint64_t output_flushes = m_output_flushes;
+    spRuntimeValue ret = execute_struct_profiled(type, runtime_value);
+    if (!is_failed() && output_flushes == m_output_flushes) {
+        m_struct_memo->insert(key, {ret, m_input.bit_position(), m_byte_order, m_output.substr(output_start),
+                                    m_output_depth, hidden, m_output_line_start});
+    }
     return ret;
 }
 
-void InterpreterContext::execute_struct(Struct &type, spStructRuntimeValue &runtime_value) {
+spRuntimeValue InterpreterContext::execute_struct_profiled(Struct &type, spStructRuntimeValue &runtime_value) {
+    if (!m_profiler)
+        return execute_struct_body(type, runtime_value);
+    m_profiler->begin(m_input.offset());
+    spRuntimeValue ret = execute_struct_body(type, runtime_value);
+    m_profiler->end(m_profiler->m_structs[&type], m_input.offset());
+    return ret;
+}
+
+spRuntimeValue InterpreterContext::execute_struct_body(Struct &type, spStructRuntimeValue &runtime_value) {
+    // only applies to this struct, not to any arrays inside it
+    int *array_index = m_array_index;
+    m_array_index = nullptr;
+
+    switch (type.m_type) {
+        case StructType::PRIMITIVE:
+            return read_primitive(type);
+        case StructType::ENUM:
+        case StructType::FLAGS: {
+            // find, not [], which would insert into the compiled tree that --zip and --dir threads share
+            const auto &modifiers = type.m_modifiers;
+            auto element_type_itr = modifiers.find(StructModifierType::ELEMENT_TYPE);
+            if (element_type_itr == modifiers.end())
+                throw "Enums and flags must have an element type";
+            Struct &element_type = static_pointer_cast<StructRef>(element_type_itr->second)->resolve(*this);
+            if (element_type.m_type != StructType::PRIMITIVE)
+                throw "The element type of enums and flags must be a primitive type";
+            return read_primitive(element_type);
+        }
+        default:
+            break;
+    }
+
     push_scope();
     m_frames.back().current_struct = runtime_value;
+
+    string *array_value = nullptr;
+    auto array_value_itr = type.m_modifiers.find(StructModifierType::ARRAY_VALUE);
+    if (array_value_itr != type.m_modifiers.end() && array_index) {
+        array_value = static_cast<string*>(array_value_itr->second.get());
+        declare_variable(*array_value) = make_shared<IntegerRuntimeValue>(*array_index);
+    }
+
+    if (type.m_type == StructType::CHOOSE) {
+        execute_choose_body(type, runtime_value);
+    } else if (type.m_type == StructType::UNION) {
+        execute_union_body(type);
+    } else {
+        for (upStatement &statement : type.m_body) {
+            execute_statement(*statement);
+            if (is_failed()) break;
+        }
+    }
+
+    // the struct may have changed the array index, e.g. to skip elements
+    if (array_value) {
+        spRuntimeValue &index = m_frames.back().vars[*array_value];
+        if (!index || index->m_type != RuntimeType::INT)
+            throw "Array value " + *array_value + " must be an integer";
+        *array_index = dynamic_cast<IntegerRuntimeValue&>(*index).m_value;
+    }
+
+    pop_scope();
+    return runtime_value;
+}
+
+/// Tries each statement in the body in turn, from the same place, until one doesn't fail. Nothing that was decoded is
+/// copied to make this possible: a failed alternative has only moved the input, appended to the output (which isn't
+/// flushed while speculating, along with any struct refs it opened on a selected path), defined values in this struct
+/// and assigned variables outside it (which are logged as they are), so those are all that need rolling back.
+void InterpreterContext::execute_choose_body(Struct &type, spStructRuntimeValue &runtime_value) {
+    if (type.m_body.empty())
+        throw "choose has no alternatives";
+    RollbackPoint start = rollback_point();
+
+    // if nothing matches, the alternative which got furthest is probably the one that was meant
+    DecodeFailure furthest;
+    for (size_t i = 0; i < type.m_body.size(); i++) {
+        Statement &alternative = *type.m_body[i];
+        bool closed = i < type.m_closed_alternatives.size() && type.m_closed_alternatives[i];
+        auto key = make_tuple(&alternative, start.position, start.byte_order);
+        if (closed) {
+            auto itr = m_failed_alternatives.find(key);
+            if (itr != m_failed_alternatives.end()) {
+                if (furthest.kind == DecodeFailure::Kind::NONE || itr->second.offset >= furthest.offset)
+                    furthest = itr->second;
+                continue;
+            }
+        }
+
+        begin_speculation();
+        push_scope();
+        execute_statement(alternative);
+        pop_scope();
+        end_speculation();
+        if (!is_failed()) {
+            forget_speculation();
+            return;
+        }
+
+        DecodeFailure failure = take_failure();
+        roll_back(start);
+        runtime_value->m_values->clear();
+        if (closed)
+            m_failed_alternatives[key] = failure;
+        if (furthest.kind == DecodeFailure::Kind::NONE || failure.offset >= furthest.offset)
+            furthest = move(failure);
+    }
+    forget_speculation();
+    fail(move(furthest));
+}
+
+/// Failed alternatives are only looked up again while an enclosing choose is still trying its alternatives from the
+/// same place, and nothing rolls back past where the outermost speculation began, so once it is done they and the undo
+/// log are dropped rather than kept for the rest of the input.
+void InterpreterContext::forget_speculation() {
+    if (m_speculation_depth == 0) {
+        m_failed_alternatives.clear();
+        m_undo_log.clear();
+    }
+}
+
+InterpreterContext::RollbackPoint InterpreterContext::rollback_point() {
+    return {m_input.bit_position(), m_byte_order, m_output.size(), m_output_line_start, m_output_depth, m_opened_path_refs,
+            m_undo_log.size(), m_frames.size()};
+}
+
+void InterpreterContext::roll_back(const RollbackPoint &point) {
+    m_input.seek_bits(point.position);
+    m_byte_order = point.byte_order;
+    m_output.resize(point.output_size);
+    m_output_line_start = point.output_line_start;
+    m_output_depth = point.output_depth;
+    for (size_t i = point.opened_path_refs; i < m_opened_path_refs; i++)
+        m_struct_refs[i].opened = false;
+    m_opened_path_refs = point.opened_path_refs;
+    // newest first, so a variable assigned more than once ends up with its oldest value
+    while (m_undo_log.size() > point.undo_log_size) {
+        UndoEntry &entry = m_undo_log.back();
+        // frames pushed since have been popped again, along with their variables
+        if (entry.frame_index < point.frames)
+            *entry.var_handle = move(entry.value);
+        m_undo_log.pop_back();
+    }
+}
+
+/// Decodes every statement in the body from the same place, and then continues after the longest
+void InterpreterContext::execute_union_body(Struct &type) {
+    uint64_t start = m_input.bit_position();
+    uint64_t end = start;
     for (upStatement &statement : type.m_body) {
+        m_input.seek_bits(start);
         execute_statement(*statement);
+        end = max(end, m_input.bit_position());
+        if (is_failed()) break;
     }
-    pop_scope();
+    m_input.seek_bits(end);
+}
+
+bool InterpreterContext::check_remaining(size_t count) {
+    if (count <= m_input.remaining())
+        return true;
+    fail(DecodeFailure::end_of_input(m_input.offset(), count, m_input.remaining()));
+    return false;
+}
+
+// bit fields and LEB128 don't have a size in bytes
+static size_t primitive_size(PrimitiveType type) {
+    switch (type) {
+        case PrimitiveType::U1: case PrimitiveType::S1: return 1;
+        case PrimitiveType::U2: case PrimitiveType::S2: return 2;
+        case PrimitiveType::U4: case PrimitiveType::S4: case PrimitiveType::F4: return 4;
+        case PrimitiveType::U8: case PrimitiveType::S8: case PrimitiveType::F8: return 8;
+        case PrimitiveType::BITS:
+        case PrimitiveType::ULEB128: case PrimitiveType::SLEB128: case PrimitiveType::VARINT: case PrimitiveType::ZIGZAG:
+            break;
+    }
+    throw "Unknown primitive type";
+}
+
+static bool is_leb128(PrimitiveType type) {
+    return type == PrimitiveType::ULEB128 || type == PrimitiveType::SLEB128 || type == PrimitiveType::VARINT || type == PrimitiveType::ZIGZAG;
+}
+
+/// What a primitive decodes to when the input has run out during speculation, so the rest of the statement
+/// sees the type it expects
+static spRuntimeValue zero_primitive(PrimitiveType type) {
+    switch (type) {
+        case PrimitiveType::U8: case PrimitiveType::S8: case PrimitiveType::VARINT: case PrimitiveType::ZIGZAG:
+            return make_shared<LongRuntimeValue>(0);
+        case PrimitiveType::F4: return make_shared<FloatRuntimeValue>(0.0f);
+        case PrimitiveType::F8: return make_shared<DoubleRuntimeValue>(0.0);
+        default: return make_shared<IntegerRuntimeValue>(0);
+    }
+}
+
+/// Bit fields of up to 32 bits are ints and longer ones longs, like u4 and u8 they are unsigned even when that doesn't fit
+spRuntimeValue InterpreterContext::read_bits(int width) {
+    if (static_cast<uint64_t>(width) > m_input.remaining_bits()) {
+        uint64_t position = m_input.bit_position();
+        size_t offset = static_cast<size_t>(position / 8);
+        fail(DecodeFailure::end_of_input(offset, static_cast<size_t>((position % 8 + width + 7) / 8), m_input.data()->size() - offset));
+        if (width > 32)
+            return make_shared<LongRuntimeValue>(0);
+        return make_shared<IntegerRuntimeValue>(0);
+    }
+    uint64_t bits = m_input.read_bits(width, m_byte_order);
+    if (width > 32)
+        return make_shared<LongRuntimeValue>(static_cast<int64_t>(bits));
+    return make_shared<IntegerRuntimeValue>(static_cast<int32_t>(static_cast<uint32_t>(bits)));
+}
+
+/// uleb128 and sleb128 are 32 bit ints as in DEX and WebAssembly, so they can be used as array sizes. varint and
+/// zigzag are 64 bit longs as in protobuf, zigzag mapping 0, 1, 2, 3... to 0, -1, 1, -2...
+spRuntimeValue InterpreterContext::read_leb128(Struct &primitive) {
+    PrimitiveType type = primitive.m_primitive_type;
+    bool is_long = type == PrimitiveType::VARINT || type == PrimitiveType::ZIGZAG;
+    size_t max_bytes = is_long ? 10 : 5;
+    uint64_t value;
+    size_t length = m_input.peek_leb128(max_bytes, value);
+    if (length == 0) {
+        size_t remaining = m_input.remaining();
+        if (remaining < max_bytes)
+            fail(DecodeFailure::end_of_input(m_input.offset(), remaining + 1, remaining));
+        else
+            fail(DecodeFailure::malformed(m_input.offset(), *primitive.m_name + " is longer than " + to_string(max_bytes) + " bytes"));
+        return zero_primitive(type);
+    }
+    // the fifth byte of a 32 bit one only has room for 4 more bits, the rest must be zeros, or copies of the sign
+    if (!is_long && length == max_bytes) {
+        uint64_t high = value >> 31;
+        if (type == PrimitiveType::SLEB128 ? high != 0 && high != 0xf : high > 1) {
+            fail(DecodeFailure::malformed(m_input.offset(), *primitive.m_name + " doesn't fit in 32 bits"));
+            return zero_primitive(type);
+        }
+    }
+    m_input.seek(m_input.offset() + length);
+
+    switch (type) {
+        case PrimitiveType::SLEB128: {
+            // the sign is the last bit that was read
+            size_t bits = 7 * length;
+            if (bits < 64 && (value >> (bits - 1)) & 1)
+                value |= ~uint64_t(0) << bits;
+            return make_shared<IntegerRuntimeValue>(static_cast<int32_t>(static_cast<uint32_t>(value)));
+        }
+        case PrimitiveType::VARINT:
+            return make_shared<LongRuntimeValue>(static_cast<int64_t>(value));
+        case PrimitiveType::ZIGZAG:
+            return make_shared<LongRuntimeValue>(static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1));
+        default:
+            return make_shared<IntegerRuntimeValue>(static_cast<int32_t>(static_cast<uint32_t>(value)));
+    }
+}
+
+spRuntimeValue InterpreterContext::read_primitive(Struct &primitive) {
+    PrimitiveType type = primitive.m_primitive_type;
+    if (type == PrimitiveType::BITS)
+        return read_bits(primitive.m_bit_width);
+    if (is_leb128(type))
+        return read_leb128(primitive);
+    if (!check_remaining(primitive_size(type)))
+        return zero_primitive(type);
+    switch (type) {
+        case PrimitiveType::U1:
+            return make_shared<IntegerRuntimeValue>(static_cast<int32_t>(m_input.read_uint(1, m_byte_order)));
+        case PrimitiveType::U2:
+            return make_shared<IntegerRuntimeValue>(static_cast<int32_t>(m_input.read_uint(2, m_byte_order)));
+        case PrimitiveType::U4:
+            return make_shared<IntegerRuntimeValue>(static_cast<int32_t>(static_cast<uint32_t>(m_input.read_uint(4, m_byte_order))));
+        case PrimitiveType::U8:
+            return make_shared<LongRuntimeValue>(static_cast<int64_t>(m_input.read_uint(8, m_byte_order)));
+        case PrimitiveType::S1:
+            return make_shared<IntegerRuntimeValue>(static_cast<int8_t>(m_input.read_uint(1, m_byte_order)));
+        case PrimitiveType::S2:
+            return make_shared<IntegerRuntimeValue>(static_cast<int16_t>(m_input.read_uint(2, m_byte_order)));
+        case PrimitiveType::S4:
+            return make_shared<IntegerRuntimeValue>(static_cast<int32_t>(m_input.read_uint(4, m_byte_order)));
+        case PrimitiveType::S8:
+            return make_shared<LongRuntimeValue>(static_cast<int64_t>(m_input.read_uint(8, m_byte_order)));
+        case PrimitiveType::F4: {
+            auto bits = static_cast<uint32_t>(m_input.read_uint(4, m_byte_order));
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return make_shared<FloatRuntimeValue>(value);
+        }
+        case PrimitiveType::F8: {
+            uint64_t bits = m_input.read_uint(8, m_byte_order);
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return make_shared<DoubleRuntimeValue>(value);
+        }
+        case PrimitiveType::BITS:
+        case PrimitiveType::ULEB128: case PrimitiveType::SLEB128: case PrimitiveType::VARINT: case PrimitiveType::ZIGZAG:
+            break;
+    }
+    throw "Unknown primitive type";
 }
 
 void InterpreterContext::handle_break() {
     broken = false;
-    for (int i = 0; i < executing_statements_to_remove; i++)
-        executing_statements.pop_back();
-    executing_statements_to_remove = 0;
+    m_broken_statements.clear();
 }
 
 void InterpreterContext::handle_continue() {
     continued = false;
-    for (int i = 0; i < executing_statements_to_remove; i++)
-        executing_statements.pop_back();
-    executing_statements_to_remove = 0;
+    m_broken_statements.clear();
+}
+
+DecodeFailure DecodeFailure::end_of_input(size_t offset, size_t needed, size_t remaining) {
+    DecodeFailure ret;
+    ret.kind = Kind::END_OF_INPUT;
+    ret.offset = offset;
+    ret.needed = needed;
+    ret.remaining = remaining;
+    return ret;
+}
+
+DecodeFailure DecodeFailure::assertion(size_t offset, spRuntimeValue message) {
+    DecodeFailure ret;
+    ret.kind = Kind::ASSERTION;
+    ret.offset = offset;
+    ret.message = move(message);
+    return ret;
+}
+
+DecodeFailure DecodeFailure::malformed(size_t offset, const string &what) {
+    DecodeFailure ret;
+    ret.kind = Kind::MALFORMED;
+    ret.offset = offset;
+    ret.message = make_shared<StringRuntimeValue>(what);
+    return ret;
+}
+
+string DecodeFailure::to_string() const {
+    switch (kind) {
+        case Kind::NONE:
+            return "No failure";
+        case Kind::END_OF_INPUT:
+            return "Unexpected end of input at offset " + std::to_string(offset) + ", needed " + std::to_string(needed) +
+                   " bytes but only " + std::to_string(remaining) + " remain";
+        case Kind::ASSERTION:
+            return message ? "Assertion failed: " + message->to_string() : "Assertion failed";
+        case Kind::MALFORMED:
+            return "Malformed input at offset " + std::to_string(offset) + ": " + message->to_string();
+    }
+    return "Unknown failure";
+}
+
+void InterpreterContext::fail(DecodeFailure failure) {
+    if (m_speculation_depth == 0)
+        throw failure.to_string();
+    // the first failure is the one that matters, anything after it is a consequence
+    if (!is_failed())
+        m_failure = move(failure);
+}
+
+DecodeFailure InterpreterContext::take_failure() {
+    DecodeFailure ret = move(m_failure);
+    m_failure = DecodeFailure();
+    return ret;
+}
+
+/// Indices usually come from the input, so inside choose one that's out of bounds means the input doesn't match this
+/// alternative. The element returned then is any other, so whatever the rest of the expression does with it still
+/// works until the failure is taken.
+spRuntimeValue InterpreterContext::index_array(RuntimeValue &array, RuntimeValue &index) {
+    if (m_speculation_depth == 0 || index.m_type != RuntimeType::INT)
+        return array[index];
+    int32_t i = static_cast<IntegerRuntimeValue&>(index).m_value;
+    size_t length;
+    if (array.m_type == RuntimeType::ARRAY)
+        length = static_cast<ArrayRuntimeValue&>(array).m_values->size();
+    else if (array.m_type == RuntimeType::BYTES)
+        length = static_cast<BytesRuntimeValue&>(array).m_length;
+    else
+        return array[index];
+    if (i >= 0 && static_cast<size_t>(i) < length)
+        return array[index];
+
+    fail(DecodeFailure::malformed(m_input.offset(), "Array index " + index.to_string() + " is out of bounds"));
+    if (array.m_type == RuntimeType::ARRAY) {
+        for (spRuntimeValue &element : *static_cast<ArrayRuntimeValue&>(array).m_values) {
+            if (element)
+                return element;
+        }
+    }
+    return make_shared<IntegerRuntimeValue>(0);
 }
 
 Struct*& InterpreterContext::declare_struct(string name) {
@@ -132,8 +741,22 @@ spRuntimeValue& InterpreterContext::declare_variable(string name) {
 }
 
 spRuntimeValue& InterpreterContext::resolve_variable(string name) {
-    for (auto frame_itr = m_frames.rbegin(); frame_itr != m_frames.rend(); ++frame_itr) {
-        StackFrame &frame = *frame_itr;
+    size_t frame_index;
+    return find_variable(name, frame_index);
+}
+
+spRuntimeValue& InterpreterContext::assign_variable(string name) {
+    size_t frame_index;
+    spRuntimeValue &var_handle = find_variable(name, frame_index);
+    // the log holding the old value also stops it being changed in place
+    if (!m_speculation_frames.empty() && frame_index < m_speculation_frames.back())
+        m_undo_log.push_back({&var_handle, var_handle, frame_index});
+    return var_handle;
+}
+
+spRuntimeValue& InterpreterContext::find_variable(const string &name, size_t &frame_index) {
+    for (frame_index = m_frames.size(); frame_index-- > 0;) {
+        StackFrame &frame = m_frames[frame_index];
         if (frame.current_struct) {
             auto itr = frame.current_struct->m_values->find(name);
             if (itr != frame.current_struct->m_values->end())
@@ -158,22 +781,189 @@ spRuntimeValue& InterpreterContext::define_struct_ref(string name) {
     throw "Assertion failed: we should always be inside a struct at some level";
 }
 
-spStructRuntimeValue InterpreterContext::begin_struct_ref(string name, map<StructRefModifierType, shared_ptr<void>> &modifiers) {
-    // TODO: do stuff here
+static bool has_struct_value(Struct &type) {
+    return type.m_type == StructType::STRUCT || type.m_type == StructType::UNION || type.m_type == StructType::CHOOSE;
+}
+
+void InterpreterContext::append_struct_ref_name(string &out, const StructRefInfo &info) {
+    out += *info.name;
+    for (size_t i = 0; i < info.index_count; i++) {
+        out += '[';
+        append_int(out, info.indices[i]);
+        out += ']';
+    }
+}
+
+spStructRuntimeValue InterpreterContext::begin_struct_ref(const string &name, Struct &type, map<StructRefModifierType, shared_ptr<void>> &modifiers,
+                                                          const int *indices, size_t index_count) {
+    bool hidden = modifiers.find(StructRefModifierType::HIDE) != modifiers.end()
+            || (!m_struct_refs.empty() && m_struct_refs.back().hidden);
+    bool on_path = false;
+    uint64_t selection_paths = 0;
+    if (m_selection && !hidden && (m_struct_refs.empty() || m_struct_refs.back().on_path)) {
+        uint64_t candidates = m_struct_refs.empty() ? m_selection->all_paths() : m_struct_refs.back().selection_paths;
+        bool selected;
+        string full_name;
+        append_struct_ref_name(full_name, {&name, indices, index_count});
+        m_selection->match(candidates, m_struct_refs.size(), full_name, selection_paths, selected);
+        if (!selected) {
+            // only structs can have something selected inside them
+            on_path = selection_paths != 0 && has_struct_value(type);
+            hidden = !on_path;
+        }
+    }
+    m_struct_refs.push_back({&name, indices, index_count, &type, hidden, on_path, false, selection_paths});
+
+    if (!has_struct_value(type))
+        return nullptr;
+
+    if (!hidden && !on_path) {
+        if (m_selection)
+            open_struct_refs_on_path();
+        begin_output_line();
+        append_struct_ref_name(m_output, m_struct_refs.back());
+        m_output += " {\n";
+        m_output_line_start = true;
+        m_output_depth++;
+    }
     return make_shared<StructRuntimeValue>();
 }
 
-void InterpreterContext::end_struct_ref() {
-    // TODO: do stuff here
+bool InterpreterContext::is_struct_ref_output(const string &name, map<StructRefModifierType, shared_ptr<void>> &modifiers) {
+    if (modifiers.find(StructRefModifierType::HIDE) != modifiers.end() || (!m_struct_refs.empty() && m_struct_refs.back().hidden))
+        return false;
+    if (!m_selection || (!m_struct_refs.empty() && !m_struct_refs.back().on_path))
+        return true;
+    uint64_t candidates = m_struct_refs.empty() ? m_selection->all_paths() : m_struct_refs.back().selection_paths;
+    return m_selection->mentions(candidates, m_struct_refs.size(), name);
 }
 
-void InterpreterContext::execute_builtin_function(string name, vector<RuntimeValue *> &args) {
-    // TODO: do stuff here
+void InterpreterContext::open_struct_refs_on_path() {
+    for (size_t i = m_opened_path_refs; i < m_struct_refs.size(); i++) {
+        StructRefInfo &info = m_struct_refs[i];
+        if (!info.on_path)
+            break;
+        begin_output_line();
+        append_struct_ref_name(m_output, info);
+        m_output += " {\n";
+        m_output_line_start = true;
+        m_output_depth++;
+        info.opened = true;
+        m_opened_path_refs++;
+    }
 }
 
-spRuntimeValue InterpreterContext::evaluate_builtin_function(string name, vector<RuntimeValue *> &args) {
-    // TODO: do stuff here
-    return make_shared<IntegerRuntimeValue>(0);
+bool InterpreterContext::is_output_selected() {
+    return !m_struct_refs.empty() && !m_struct_refs.back().hidden && !m_struct_refs.back().on_path;
+}
+
+/// Appends a value decoded from a struct ref, taking into account that unsigned primitives are stored in signed values
+static void append_struct_ref_value(string &out, Struct &type, RuntimeValue &value) {
+    if (type.m_enum_names && (value.m_type == RuntimeType::INT || value.m_type == RuntimeType::LONG)) {
+        if (type.m_type == StructType::ENUM) {
+            int64_t key = value.m_type == RuntimeType::INT ? dynamic_cast<IntegerRuntimeValue&>(value).m_value : dynamic_cast<LongRuntimeValue&>(value).m_value;
+            type.m_enum_names->append_enum(out, key);
+        } else {
+            // flags are bit patterns, don't sign extend
+            uint64_t bits = value.m_type == RuntimeType::INT ? static_cast<uint32_t>(dynamic_cast<IntegerRuntimeValue&>(value).m_value) : static_cast<uint64_t>(dynamic_cast<LongRuntimeValue&>(value).m_value);
+            type.m_enum_names->append_flags(out, bits);
+        }
+        return;
+    }
+    if (type.m_type == StructType::PRIMITIVE) {
+        bool is_unsigned = type.m_primitive_type == PrimitiveType::BITS || type.m_primitive_type == PrimitiveType::ULEB128 ||
+                           type.m_primitive_type == PrimitiveType::VARINT;
+        if ((is_unsigned || type.m_primitive_type == PrimitiveType::U4) && value.m_type == RuntimeType::INT) {
+            append_uint(out, static_cast<uint32_t>(dynamic_cast<IntegerRuntimeValue&>(value).m_value));
+            return;
+        }
+        if ((is_unsigned || type.m_primitive_type == PrimitiveType::U8) && value.m_type == RuntimeType::LONG) {
+            append_uint(out, static_cast<uint64_t>(dynamic_cast<LongRuntimeValue&>(value).m_value));
+            return;
+        }
+    }
+    value.append_to(out);
+}
+
+void InterpreterContext::end_struct_ref(spRuntimeValue &value) {
+    StructRefInfo &info = m_struct_refs.back();
+    if (info.on_path) {
+        if (info.opened) {
+            m_output_depth--;
+            m_opened_path_refs--;
+            begin_output_line();
+            m_output += "}\n";
+            m_output_line_start = true;
+        }
+    } else if (!info.hidden) {
+        if (has_struct_value(*info.type)) {
+            m_output_depth--;
+            begin_output_line();
+            m_output += "}\n";
+        } else {
+            if (m_selection)
+                open_struct_refs_on_path();
+            begin_output_line();
+            append_struct_ref_name(m_output, info);
+            m_output += " = ";
+            append_struct_ref_value(m_output, *info.type, *value);
+            m_output += '\n';
+        }
+        m_output_line_start = true;
+        if (m_output.size() >= OUTPUT_BUFFER_SIZE && m_speculation_depth == 0)
+            flush_output();
+    }
+    m_struct_refs.pop_back();
+}
+
+void InterpreterContext::begin_output_line() {
+    if (!m_output_line_start)
+        m_output += '\n';
+    m_output.append(2 * m_output_depth, ' ');
+    m_output_line_start = false;
+}
+
+void InterpreterContext::write_output(const string &text) {
+    if (text.empty())
+        return;
+    if (m_selection) {
+        if (!is_output_selected())
+            return;
+        open_struct_refs_on_path();
+    }
+    if (m_output_line_start)
+        m_output.append(2 * m_output_depth, ' ');
+    m_output += text;
+    m_output_line_start = text.back() == '\n';
+    if (m_output.size() >= OUTPUT_BUFFER_SIZE && m_speculation_depth == 0)
+        flush_output();
+}
+
+void InterpreterContext::flush_output() {
+    m_output_written += m_output.size();
+    m_output_flushes++;
+    if (m_output_writer) {
+        if (!m_output.empty())
+            m_output_writer->write(m_output);
+        return;
+    }
+    fwrite(m_output.data(), 1, m_output.size(), m_output_file);
+    fflush(m_output_file);
+    m_output.clear();
+}
+
+void InterpreterContext::sync_output() {
+    flush_output();
+    if (m_output_writer)
+        m_output_writer->drain();
+}
+
+spRuntimeValue& InterpreterContext::define_constant(string name) {
+    return m_frames.back().vars[name];
+}
+
+spRuntimeValue& InterpreterContext::define_global_constant(string name) {
+    return m_frames.front().vars[name];
 }
 
 void InterpreterContext::push_scope() {
@@ -189,31 +979,318 @@ void declare_builtin_variables(InterpreterContext &context) {
     context.declare_variable("std::big_endian") = make_shared<IntegerRuntimeValue>(1);
 }
 
+static vector<upStruct> create_primitive_structs() {
+    static const pair<const char*, PrimitiveType> primitives[] = {
+            {"u1", PrimitiveType::U1}, {"u2", PrimitiveType::U2}, {"u4", PrimitiveType::U4}, {"u8", PrimitiveType::U8},
+            {"s1", PrimitiveType::S1}, {"s2", PrimitiveType::S2}, {"s4", PrimitiveType::S4}, {"s8", PrimitiveType::S8},
+            {"f4", PrimitiveType::F4}, {"f8", PrimitiveType::F8},
+            {"uleb128", PrimitiveType::ULEB128}, {"sleb128", PrimitiveType::SLEB128},
+            {"varint", PrimitiveType::VARINT}, {"zigzag", PrimitiveType::ZIGZAG}
+    };
+    vector<upStruct> ret;
+    for (auto &primitive : primitives) {
+        auto type = make_unique<Struct>();
+        type->m_type = StructType::PRIMITIVE;
+        type->m_primitive_type = primitive.second;
+        type->m_fixed_size = is_leb128(primitive.second) ? -1 : static_cast<int64_t>(primitive_size(primitive.second));
+        type->m_name = make_unique<string>(primitive.first);
+        ret.push_back(move(type));
+    }
+    // b1 to b64 are bit fields, they have no fixed size in bytes
+    for (int width = 1; width <= 64; width++) {
+        auto type = make_unique<Struct>();
+        type->m_type = StructType::PRIMITIVE;
+        type->m_primitive_type = PrimitiveType::BITS;
+        type->m_bit_width = width;
+        type->m_name = make_unique<string>("b" + to_string(width));
+        ret.push_back(move(type));
+    }
+    return ret;
+}
+
+void declare_builtin_structs(InterpreterContext &context) {
+    static vector<upStruct> primitive_structs = create_primitive_structs();
+    for (upStruct &type : primitive_structs)
+        context.declare_struct(*type->m_name) = &*type;
+}
+
 void InterpreterContext::handle_error(string error, ErrorHandler error_handler) {
+    // the handler wants the outermost statement first, and an unhandled break has no exception to unwind
+    vector<Statement*> executing_statements(m_error_statements.rbegin(), m_error_statements.rend());
+    if (executing_statements.empty())
+        executing_statements.assign(m_broken_statements.rbegin(), m_broken_statements.rend());
+    vector<Expression*> evaluating_expressions(m_error_expressions.rbegin(), m_error_expressions.rend());
     error_handler(error, executing_statements, evaluating_expressions);
 }
 
-void execute(vector<upStatement> &statements, ErrorHandler error_handler) {
-    InterpreterContext context;
+void InterpreterContext::clear_error_trace() {
+    m_error_statements.clear();
+    m_error_expressions.clear();
+}
+
+/// Offsets in the substream mean something else, so the memo and failed alternatives from outside it don't apply
+void InterpreterContext::execute_substream(Input input, Statement &statement) {
+    swap(m_input, input);
+    StructMemo *struct_memo = m_struct_memo;
+    m_struct_memo = nullptr;
+    decltype(m_failed_alternatives) failed_alternatives;
+    swap(m_failed_alternatives, failed_alternatives);
+    auto restore = [&]() {
+        swap(m_input, input);
+        m_struct_memo = struct_memo;
+        swap(m_failed_alternatives, failed_alternatives);
+    };
+    try {
+        execute_statement(statement);
+    } catch (...) {
+        restore();
+        throw;
+    }
+    restore();
+}
+
+void InterpreterContext::execute_top_level_statement(Statement &statement) {
+    execute_statement(statement);
+    if (is_broken()) {
+        throw "break statement not handled";
+    }
+    if (is_continued()) {
+        throw "continue statement not handled";
+    }
+}
+
+/// Speculates like execute_choose_body, so running out of input can be undone. A record is decoded in a struct of its
+/// own, so it can be decoded any number of times; other statements define their values at the top level, and any they
+/// defined before running out are removed again. Either way variables they assigned get their old values back.
+bool InterpreterContext::execute_following(Statement &statement, bool is_record, const WaitForInput &wait_for_input) {
+    auto run = [this, &statement, is_record]() {
+        if (is_record) {
+            push_scope();
+            m_frames.back().current_struct = make_shared<StructRuntimeValue>();
+            execute_top_level_statement(statement);
+            pop_scope();
+        } else {
+            execute_top_level_statement(statement);
+        }
+    };
+    StackFrame &top_level = m_frames.front();
+    while (true) {
+        RollbackPoint start = rollback_point();
+        set<string> defined;
+        if (!is_record) {
+            for (auto &value : *top_level.current_struct->m_values)
+                defined.insert(value.first);
+            for (auto &var : top_level.vars)
+                defined.insert(var.first);
+        }
+
+        begin_speculation();
+        run();
+        end_speculation();
+        if (!is_failed()) {
+            forget_speculation();
+            return true;
+        }
+
+        DecodeFailure failure = take_failure();
+        // also puts back the values of variables the statement assigned, such as a count kept at the top level
+        roll_back(start);
+        // those which ran out of input may not once more has been waited for
+        forget_speculation();
+        if (!is_record) {
+            auto undefine = [&defined](map<string, spRuntimeValue> &values) {
+                for (auto itr = values.begin(); itr != values.end();) {
+                    if (defined.find(itr->first) == defined.end())
+                        itr = values.erase(itr);
+                    else
+                        ++itr;
+                }
+            };
+            undefine(*top_level.current_struct->m_values);
+            undefine(top_level.vars);
+        }
+        if (failure.kind == DecodeFailure::Kind::END_OF_INPUT) {
+            flush_output();
+            if (wait_for_input(m_input))
+                continue;
+        }
+        // more input won't help, decode it again for real so the error is reported where it happens
+        run();
+        return false;
+    }
+}
+
+void InterpreterContext::follow(vector<upStatement> &statements, size_t first, const WaitForInput &wait_for_input) {
+    if (statements.empty())
+        return;
+    for (size_t i = first; i + 1 < statements.size(); i++) {
+        if (!execute_following(*statements[i], false, wait_for_input))
+            return;
+        top_level_statement_done(i + 1);
+    }
+    Statement &record = *statements.back();
+    while (true) {
+        if (m_input.remaining() == 0) {
+            flush_output();
+            if (!wait_for_input(m_input))
+                return;
+        } else if (!execute_following(record, true, wait_for_input)) {
+            return;
+        } else {
+            top_level_statement_done(statements.size() - 1);
+        }
+    }
+}
+
+static const char CHECKPOINT_MAGIC[] = "decode-bin checkpoint";
+const uint64_t CHECKPOINT_VERSION = 3;
+
+void InterpreterContext::set_checkpoints(const string &filename, uint64_t every, vector<upStatement> &statements) {
+    m_checkpoint_file = filename;
+    m_checkpoint_every = every;
+    m_top_level_statements = statements.size();
+    m_declared_structs = declared_structs(statements);
+}
+
+void InterpreterContext::top_level_statement_done(size_t next_statement) {
+    if (m_checkpoint_every == 0 || ++m_statements_since_checkpoint < m_checkpoint_every)
+        return;
+    m_statements_since_checkpoint = 0;
+    write_checkpoint(next_statement);
+}
+
+/// Only the top level needs saving: between top level statements nothing else is on the stack, and everything that
+/// is output has been flushed
+void InterpreterContext::write_checkpoint(size_t next_statement) {
+    sync_output();
+    map<Struct*, uint64_t> struct_indices;
+    for (size_t i = 0; i < m_declared_structs.size(); i++)
+        struct_indices[m_declared_structs[i]] = i;
+
+    CheckpointWriter writer(m_input.data());
+    writer.write_string(CHECKPOINT_MAGIC);
+    writer.write_u64(CHECKPOINT_VERSION);
+    writer.write_u64(m_top_level_statements);
+    writer.write_u64(m_declared_structs.size());
+    writer.write_u64(next_statement);
+    writer.write_u64(m_input.bit_position());
+    writer.write_u8(m_byte_order == ByteOrder::BIG);
+    writer.write_u64(m_output_written);
+    writer.write_u8(m_output_line_start);
+
+    // builtin structs are declared again anyway
+    vector<pair<const string*, uint64_t>> declared;
+    for (auto &type : m_struct_types) {
+        auto itr = struct_indices.find(type.second);
+        if (itr != struct_indices.end())
+            declared.emplace_back(&type.first, itr->second);
+    }
+    writer.write_u64(declared.size());
+    for (auto &type : declared) {
+        writer.write_string(*type.first);
+        writer.write_u64(type.second);
+    }
+
+    StackFrame &top_level = m_frames.front();
+    writer.write_u64(top_level.vars.size());
+    for (auto &var : top_level.vars) {
+        writer.write_string(var.first);
+        writer.write_value(var.second.get());
+    }
+    writer.write_value(top_level.current_struct.get());
+
+    if (!writer.save(m_checkpoint_file))
+        throw "Failed to write checkpoint " + m_checkpoint_file;
+}
+
+size_t InterpreterContext::resume_from_checkpoint() {
+    CheckpointReader reader;
+    if (!reader.load(m_checkpoint_file))
+        throw "Failed to read checkpoint " + m_checkpoint_file;
+    if (reader.read_string() != CHECKPOINT_MAGIC || reader.read_u64() != CHECKPOINT_VERSION)
+        throw m_checkpoint_file + " is not a checkpoint";
+    if (reader.read_u64() != m_top_level_statements || reader.read_u64() != m_declared_structs.size())
+        throw "Checkpoint was written for a different binformat";
+    uint64_t next_statement = reader.read_u64();
+    uint64_t position = reader.read_u64();
+    if (next_statement > m_top_level_statements || position > static_cast<uint64_t>(m_input.data()->size()) * 8)
+        throw "Checkpoint was written for a different input";
+    m_input.seek_bits(position);
+    m_byte_order = reader.read_u8() ? ByteOrder::BIG : ByteOrder::LITTLE;
+    m_output_written = reader.read_u64();
+    m_output_line_start = reader.read_u8() != 0;
+
+    for (uint64_t count = reader.read_u64(); count != 0; count--) {
+        string name = reader.read_string();
+        uint64_t index = reader.read_u64();
+        if (index >= m_declared_structs.size())
+            throw "Checkpoint was written for a different binformat";
+        m_struct_types[name] = m_declared_structs[index];
+    }
+
+    StackFrame &top_level = m_frames.front();
+    for (uint64_t count = reader.read_u64(); count != 0; count--) {
+        string name = reader.read_string();
+        top_level.vars[name] = reader.read_value(m_input.data());
+    }
+    spRuntimeValue top_level_values = reader.read_value(m_input.data());
+    if (!top_level_values || top_level_values->m_type != RuntimeType::STRUCT)
+        throw "Checkpoint is corrupt";
+    top_level.current_struct = static_pointer_cast<StructRuntimeValue>(top_level_values);
+
+    // the output from before the checkpoint is kept, anything after it would be written again
+    fflush(m_output_file);
+    struct stat status;
+    int fd = fileno(m_output_file);
+    if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode)) {
+        if (static_cast<uint64_t>(status.st_size) < m_output_written)
+            throw string("The output is shorter than when the checkpoint was written, append to it with >> to resume");
+        if (ftruncate(fd, static_cast<off_t>(m_output_written)) != 0)
+            throw string("Failed to truncate the output to where the checkpoint was written");
+        fseek(m_output_file, 0, SEEK_END);
+    }
+    return next_statement;
+}
+
+bool execute(vector<upStatement> &statements, Input input, InterpreterOptions &options, ErrorHandler error_handler) {
+    InterpreterContext context(move(input));
+    context.set_profiler(options.profiler);
+    context.set_output_file(options.output_file);
+    context.set_output_writer(options.output_writer);
+    if (options.struct_memo)
+        options.struct_memo->clear();
+    context.set_struct_memo(options.struct_memo);
+    context.set_selection(options.selection);
     context.push_scope();
     context.m_frames.back().current_struct = make_shared<StructRuntimeValue>();
     declare_builtin_variables(context);
+    declare_builtin_structs(context);
+
+    if (!options.checkpoint_file.empty())
+        context.set_checkpoints(options.checkpoint_file, options.checkpoint_every, statements);
 
+    bool success = true;
     try {
-        for (upStatement &statement : statements) {
-            context.execute_statement(*statement);
-            if (context.is_broken()) {
-                throw "break statement not handled";
-            }
-            if (context.is_continued()) {
-                throw "continue statement not handled";
+        size_t first = options.resume ? context.resume_from_checkpoint() : 0;
+        if (options.wait_for_input) {
+            context.follow(statements, first, options.wait_for_input);
+        } else {
+            for (size_t i = first; i < statements.size(); i++) {
+                context.execute_top_level_statement(*statements[i]);
+                context.top_level_statement_done(i + 1);
             }
         }
     } catch (const char *error) {
+        context.sync_output();
         context.handle_error(string(error), error_handler);
+        success = false;
     } catch (string &error) {
+        context.sync_output();
         context.handle_error(error, error_handler);
+        success = false;
     }
+    context.sync_output();
 
     context.pop_scope();
+    return success;
 }
@@ -3,20 +3,30 @@
 #define DECODE_BIN_INTERPRETER_H
 
 #include <cstdint>
+#include <cstdio>
 #include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <tuple>
+#include "format.h"
+#include "input.h"
+#include "memo.h"
+#include "profile.h"
+#include "selection.h"
 
 
 class Expression;
 class Statement;
 class Struct;
+class OutputWriter;
 enum class StructRefModifierType;
+enum class PrimitiveType;
 
 enum class RuntimeType {
-    INT, LONG, FLOAT, DOUBLE, BOOLEAN, ARRAY, STRUCT
+    INT, LONG, FLOAT, DOUBLE, BOOLEAN, ARRAY, STRUCT, STRING, BYTES
 };
 struct RuntimeValue {
 public:
@@ -53,7 +63,13 @@ public:
 #undef DEFAULT_OPERATOR
 
     virtual bool to_boolean() { throw "Cannot interpret " + to_string() + " as a boolean"; }
-    virtual std::string to_string() = 0;
+    // appends the text form of this value to out, so that nested values can share one buffer
+    virtual void append_to(std::string &out) = 0;
+    std::string to_string() {
+        std::string ret;
+        append_to(ret);
+        return ret;
+    }
 };
 typedef std::shared_ptr<RuntimeValue> spRuntimeValue;
 
@@ -107,7 +123,7 @@ public:
     spRuntimeValue operator~() override;
 
     bool to_boolean() override { return m_value; }
-    std::string to_string() override;
+    void append_to(std::string &out) override;
 };
 
 class ArrayRuntimeValue : public RuntimeValue {
@@ -135,7 +151,7 @@ public:
 
     spRuntimeValue copy() override { return std::make_shared<ArrayRuntimeValue>(m_values); }
 
-    std::string to_string() override;
+    void append_to(std::string &out) override;
 };
 
 class StructRuntimeValue : public RuntimeValue {
@@ -151,30 +167,230 @@ public:
 
     spRuntimeValue copy() override { return std::make_shared<StructRuntimeValue>(m_values); }
 
-    std::string to_string() override;
+    void append_to(std::string &out) override;
 };
 typedef std::shared_ptr<StructRuntimeValue> spStructRuntimeValue;
 
+class StringRuntimeValue : public RuntimeValue {
+public:
+    std::string m_value;
+
+    explicit StringRuntimeValue(std::string value) : RuntimeValue(RuntimeType::STRING), m_value(std::move(value)) {}
+
+    spRuntimeValue copy() override { return std::make_shared<StringRuntimeValue>(m_value); }
+
+    spRuntimeValue operator+(RuntimeValue &right) override;
+    spRuntimeValue operator==(RuntimeValue &right) override;
+    spRuntimeValue operator!=(RuntimeValue &right) override;
+
+    void append_to(std::string &out) override { out += m_value; }
+};
+
+/// A run of bytes viewed directly in the input, used for arrays of u1/s1 so that they don't need a value per element
+class BytesRuntimeValue : public RuntimeValue {
+public:
+    spInputData m_data;
+    size_t m_offset;
+    size_t m_length;
+    bool m_signed;
+
+    BytesRuntimeValue(spInputData data, size_t offset, size_t length, bool is_signed)
+            : RuntimeValue(RuntimeType::BYTES), m_data(std::move(data)), m_offset(offset), m_length(length), m_signed(is_signed) {}
+
+    const uint8_t *bytes() { return m_data->data() + m_offset; }
+
+    spRuntimeValue operator[](RuntimeValue &other) override {
+        if (other.m_type != RuntimeType::INT)
+            throw "Can only index arrays with integers, " + other.to_string() + " used";
+        int32_t val = dynamic_cast<IntegerRuntimeValue&>(other).m_value;
+        if (val < 0 || static_cast<size_t>(val) >= m_length)
+            throw "Array index " + other.to_string() + " is out of bounds";
+        uint8_t byte = bytes()[val];
+        return std::make_shared<IntegerRuntimeValue>(m_signed ? static_cast<int8_t>(byte) : byte);
+    }
+
+    spRuntimeValue copy() override { return std::make_shared<BytesRuntimeValue>(m_data, m_offset, m_length, m_signed); }
+
+    void append_to(std::string &out) override;
+};
+
 typedef std::function<void(std::string&, std::vector<Statement*>&, std::vector<Expression*>&)> ErrorHandler;
+// blocks until more has been appended to the input, returns false if there won't be any more
+typedef std::function<bool(Input&)> WaitForInput;
+
+/// A failure that says the input doesn't match the schema, rather than that the schema is wrong.
+/// Inside choose these are expected, so they're recorded without formatting a message or throwing.
+struct DecodeFailure {
+    enum class Kind {
+        NONE, END_OF_INPUT, ASSERTION, MALFORMED
+    } kind = Kind::NONE;
+    // where in the input it failed
+    size_t offset = 0;
+    // END_OF_INPUT
+    size_t needed = 0, remaining = 0;
+    // ASSERTION, nullptr if the assert has no message, or what is wrong for MALFORMED
+    spRuntimeValue message;
+
+    static DecodeFailure end_of_input(size_t offset, size_t needed, size_t remaining);
+    static DecodeFailure assertion(size_t offset, spRuntimeValue message);
+    // input that can't be decoded at all, such as corrupt compressed data
+    static DecodeFailure malformed(size_t offset, const std::string &what);
+
+    std::string to_string() const;
+};
+
+const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
 
 class InterpreterContext {
     struct StackFrame {
         std::map<std::string, spRuntimeValue> vars;
         spStructRuntimeValue current_struct;
     };
+    // The name is only turned into text when something outputs it. An array element is the name of the array and
+    // its indices, which both belong to whoever is decoding it and outlive the struct ref.
+    struct StructRefInfo {
+        const std::string *name;
+        const int *indices;
+        size_t index_count;
+        Struct *type = nullptr;
+        bool hidden = false;
+        // With a selection: on_path struct refs aren't selected themselves but something in them might be, so they
+        // are only opened in the output once something in them is output. selection_paths are the paths they're on.
+        bool on_path = false;
+        bool opened = false;
+        uint64_t selection_paths = 0;
+    };
     std::map<std::string, Struct*> m_struct_types;
+    std::set<Struct*> m_defined_enums;
 
     bool broken = false, continued = false;
-
-    std::vector<Statement*> executing_statements;
-    std::vector<Expression*> evaluating_expressions;
-    int executing_statements_to_remove = 0;
+    // only recorded while speculating, otherwise failures are thrown
+    DecodeFailure m_failure;
+    int m_speculation_depth = 0;
+    // closed choose alternatives which failed at a position with a byte order, so they aren't tried there again while
+    // speculating, see forget_speculation()
+    std::map<std::tuple<Statement*, uint64_t, ByteOrder>, DecodeFailure> m_failed_alternatives;
+    // m_frames.size() when each speculation began, innermost last
+    std::vector<size_t> m_speculation_frames;
+    // the values which variables in frames from before the innermost speculation had before it assigned them
+    struct UndoEntry {
+        spRuntimeValue *var_handle;
+        spRuntimeValue value;
+        size_t frame_index;
+    };
+    std::vector<UndoEntry> m_undo_log;
+
+    Input m_input;
+    ByteOrder m_byte_order = ByteOrder::LITTLE;
+
+    std::vector<StructRefInfo> m_struct_refs;
+    std::string m_output;
+    int m_output_depth = 0;
+    bool m_output_line_start = true;
+    // set while decoding the elements of an array, for structs declared with array_value
+    int *m_array_index = nullptr;
+
+    Profiler *m_profiler = nullptr;
+    StructMemo *m_struct_memo = nullptr;
+    // nullptr to output everything
+    const Selection *m_selection = nullptr;
+    // the number of on_path struct refs which have been opened, which are always the outermost ones
+    size_t m_opened_path_refs = 0;
+    FILE *m_output_file = stdout;
+    // nullptr to write output on this thread
+    OutputWriter *m_output_writer = nullptr;
+    // counts calls to flush_output, so output captured for the memo can tell it's incomplete
+    uint64_t m_output_flushes = 0;
+    // bytes written to m_output_file, including by the run a checkpoint was resumed from
+    uint64_t m_output_written = 0;
+
+    // for --checkpoint-every, structs are saved as indices into m_declared_structs
+    std::string m_checkpoint_file;
+    uint64_t m_checkpoint_every = 0;
+    uint64_t m_statements_since_checkpoint = 0;
+    size_t m_top_level_statements = 0;
+    std::vector<Struct*> m_declared_structs;
+
+    void begin_output_line();
+    // e.g. constant_pool[3]
+    static void append_struct_ref_name(std::string &out, const StructRefInfo &info);
+    // outputs the headers of on_path struct refs which haven't been opened yet, before something inside them
+    void open_struct_refs_on_path();
+    bool is_output_selected();
+    spRuntimeValue execute_struct_profiled(Struct &type, spStructRuntimeValue &runtime_value);
+    spRuntimeValue execute_struct_memoized(Struct &type, spStructRuntimeValue &runtime_value);
+    spRuntimeValue execute_struct_body(Struct &type, spStructRuntimeValue &runtime_value);
+    // what a speculative decode which failed has to undo
+    struct RollbackPoint {
+        // in bits, see Input::bit_position()
+        uint64_t position;
+        ByteOrder byte_order;
+        size_t output_size;
+        bool output_line_start;
+        int output_depth;
+        size_t opened_path_refs;
+        size_t undo_log_size;
+        size_t frames;
+    };
+    RollbackPoint rollback_point();
+    void roll_back(const RollbackPoint &point);
+    // frame_index is set to the index in m_frames of the frame the variable was found in
+    spRuntimeValue& find_variable(const std::string &name, size_t &frame_index);
+    // returns false if wait_for_input gave up, or the statement failed other than by running out of input
+    bool execute_following(Statement &statement, bool is_record, const WaitForInput &wait_for_input);
+    void write_checkpoint(size_t next_statement);
+    void execute_choose_body(Struct &type, spStructRuntimeValue &runtime_value);
+    void forget_speculation();
+    void execute_union_body(Struct &type);
+
+    // Where the current error was thrown from, innermost first. These are only filled in while an exception
+    // unwinds through execute_statement and evaluate_expression, so the happy path doesn't pay for them.
+    std::vector<Statement*> m_error_statements;
+    std::vector<Expression*> m_error_expressions;
+    // statements which a break or continue is unwinding through, innermost first, until it is handled
+    std::vector<Statement*> m_broken_statements;
 public:
     std::vector<StackFrame> m_frames;
 
+    explicit InterpreterContext(Input input) : m_input(std::move(input)) {}
+
+    // nullptr to not profile
+    void set_profiler(Profiler *profiler) { m_profiler = profiler; }
+    void set_output_file(FILE *output_file) { m_output_file = output_file; }
+    void set_output_writer(OutputWriter *output_writer) { m_output_writer = output_writer; }
+    // nullptr to not memoize
+    void set_struct_memo(StructMemo *struct_memo) { m_struct_memo = struct_memo; }
+    // nullptr to output everything
+    void set_selection(const Selection *selection) { m_selection = selection; }
+
     void execute_statement(Statement &statement);
+    // decodes the statement from another input, such as inflated data, and then goes back to this one
+    void execute_substream(Input input, Statement &statement);
+    // also throws for a break or continue which nothing handled
+    void execute_top_level_statement(Statement &statement);
     spRuntimeValue evaluate_expression(Expression &expression);
-    void execute_struct(Struct &type, spStructRuntimeValue &runtime_value);
+    // Decodes input which is still being appended to: the top level statements before the last are a header, decoded
+    // once, and the last is a record, decoded again for as long as there is input. A statement which runs out of input
+    // is undone, and decoded again from the same place once wait_for_input has read more. Starts from statement first.
+    void follow(std::vector<std::unique_ptr<Statement>> &statements, size_t first, const WaitForInput &wait_for_input);
+
+    // writes a checkpoint to filename after every `every` top level statements, or records when following
+    void set_checkpoints(const std::string &filename, uint64_t every, std::vector<std::unique_ptr<Statement>> &statements);
+    // called after each top level statement, with the index of the next
+    void top_level_statement_done(size_t next_statement);
+    // Restores the top level from the checkpoint, and cuts the output back to what it was then if it's a file.
+    // Returns the index of the top level statement to carry on from.
+    size_t resume_from_checkpoint();
+    // returns the value the struct ref should be defined to, which is runtime_value unless it's a primitive or enum
+    spRuntimeValue execute_struct(Struct &type, spStructRuntimeValue &runtime_value);
+
+    Input &input() { return m_input; }
+    // returns false after calling fail() if there aren't count bytes left
+    bool check_remaining(size_t count);
+    // type is a primitive, including bit fields
+    spRuntimeValue read_primitive(Struct &type);
+    spRuntimeValue read_bits(int width);
+    spRuntimeValue read_leb128(Struct &type);
 
     void do_break() { broken = true; }
     void do_continue() { continued = true; }
@@ -183,34 +399,119 @@ public:
     void handle_break();
     void handle_continue();
 
+    // Reports a recoverable failure. While speculating it is recorded, and loops and struct bodies stop executing
+    // until whoever started speculating takes it. Otherwise it's thrown like any other error.
+    void fail(DecodeFailure failure);
+    bool is_failed() { return m_failure.kind != DecodeFailure::Kind::NONE; }
+    bool is_speculating() { return m_speculation_depth > 0; }
+    void begin_speculation() { m_speculation_depth++; m_speculation_frames.push_back(m_frames.size()); }
+    void end_speculation() { m_speculation_depth--; m_speculation_frames.pop_back(); }
+    // returns the recorded failure and clears it so execution can continue
+    DecodeFailure take_failure();
+    // array[index], except that an index out of bounds while speculating fails rather than throwing
+    spRuntimeValue index_array(RuntimeValue &array, RuntimeValue &index);
+
     // tried to make this Struct&& but the compiler didn't like it
     Struct*& declare_struct(std::string name);
     Struct& resolve_struct(std::string name);
 
     spRuntimeValue& declare_variable(std::string name);
     spRuntimeValue& resolve_variable(std::string name);
+    // resolve_variable for a variable about to be assigned, so it can be rolled back if speculating
+    spRuntimeValue& assign_variable(std::string name);
 
-    spRuntimeValue& define_struct_ref(std::string name);
-    spStructRuntimeValue begin_struct_ref(std::string name, std::map<StructRefModifierType, std::shared_ptr<void>> &modifiers);
-    void end_struct_ref();
+    // like declare_variable, but for enum members which are redefined each time the enum declaration is executed
+    spRuntimeValue& define_constant(std::string name);
+    // defines in the outermost scope, for enum members which are the same everywhere
+    spRuntimeValue& define_global_constant(std::string name);
+    // returns true the first time it's called for that enum
+    bool mark_enum_defined(Struct *type) { return m_defined_enums.insert(type).second; }
 
-    void execute_builtin_function(std::string name, std::vector<RuntimeValue*> &args);
-    spRuntimeValue evaluate_builtin_function(std::string name, std::vector<RuntimeValue*> &args);
+    spRuntimeValue& define_struct_ref(std::string name);
+    // Returns nullptr for types which don't decode to a struct value. name, and indices for an array element, must
+    // stay as they are until end_struct_ref.
+    spStructRuntimeValue begin_struct_ref(const std::string &name, Struct &type, std::map<StructRefModifierType, std::shared_ptr<void>> &modifiers,
+                                          const int *indices = nullptr, size_t index_count = 0);
+    void end_struct_ref(spRuntimeValue &value);
+    // false if a struct ref with this name, defined here, would neither be output itself nor contain anything output
+    bool is_struct_ref_output(const std::string &name, std::map<StructRefModifierType, std::shared_ptr<void>> &modifiers);
+    void set_array_index(int *index) { m_array_index = index; }
+
+    void set_byte_order(ByteOrder byte_order) { m_byte_order = byte_order; }
+
+    // for print and friends, struct refs are output by end_struct_ref
+    void write_output(const std::string &text);
+    void flush_output();
+    // waits until what has been flushed is in the output file, for what has to come after it there or on stderr
+    void sync_output();
 
     void push_scope();
     void pop_scope();
 
     void handle_error(std::string error, ErrorHandler error_handler);
+    // forgets where the last error was thrown from, for callers which recover from errors
+    void clear_error_trace();
+};
+
+// std::little_endian and friends
+void declare_builtin_variables(InterpreterContext &context);
+// the primitive types, u1 and friends
+void declare_builtin_structs(InterpreterContext &context);
+
+struct InterpreterOptions {
+    // filled in during execution if not nullptr
+    Profiler *profiler = nullptr;
+    // where decoded output goes
+    FILE *output_file = stdout;
+    // if not nullptr, output is handed to this to write to output_file on its own thread
+    OutputWriter *output_writer = nullptr;
+    // if not nullptr, closed structs decoded again from the same place are looked up here, it is cleared first
+    StructMemo *struct_memo = nullptr;
+    // if not nullptr, only struct refs on these paths, and what is printed inside them, are output
+    const Selection *selection = nullptr;
+    // if set, the input is still being appended to, see InterpreterContext::follow
+    WaitForInput wait_for_input;
+    // if not empty, the state between top level statements is saved here after every checkpoint_every of them
+    std::string checkpoint_file;
+    uint64_t checkpoint_every = 0;
+    // carry on from the checkpoint in checkpoint_file rather than from the start
+    bool resume = false;
 };
 
-void execute(std::vector<std::unique_ptr<Statement>> &statements, ErrorHandler error_handler);
+// returns false if there was an error, after passing it to the error handler
+bool execute(std::vector<std::unique_ptr<Statement>> &statements, Input input, InterpreterOptions &options, ErrorHandler error_handler);
 
 typedef std::function<spRuntimeValue(RuntimeValue&)> UnaryOperator;
 typedef std::function<spRuntimeValue(RuntimeValue&, Expression&, InterpreterContext&)> BinaryOperator;
 typedef std::function<spRuntimeValue(RuntimeValue&, RuntimeValue&)> AssignmentOperator;
+// Updates left where it is, for a value nothing else holds. Returns false without changing it if the result would be
+// of another type, or isn't an int or long.
+typedef bool (*InPlaceOperator)(RuntimeValue &left, RuntimeValue &right);
 
 bool is_assignment_operator(std::string token);
 AssignmentOperator get_assignment_operator(std::string token);
+// returns nullptr for operators which are never done in place, including =
+InPlaceOperator get_in_place_operator(const std::string &token);
+// adds delta to an int or long, returns false for anything else
+bool increment_in_place(RuntimeValue &value, int delta);
+
+// An operator for operands of known types, which compile() picks for expressions whose operand types it can work
+// out. apply is nullptr if there isn't one for those types.
+struct TypedBinaryOperator {
+    // only for operands of exactly the types left and right
+    spRuntimeValue (*apply)(RuntimeValue &left, RuntimeValue &right);
+    // the same operator for operands of any type
+    spRuntimeValue (*generic)(RuntimeValue &left, RuntimeValue &right);
+    RuntimeType left, right, result;
+};
+struct TypedUnaryOperator {
+    spRuntimeValue (*apply)(RuntimeValue &operand);
+    spRuntimeValue (*generic)(RuntimeValue &operand);
+    RuntimeType operand, result;
+};
+// ints and longs have every operator, booleans only the logical ones and == and !=
+TypedBinaryOperator get_typed_binary_operator(const std::string &op, RuntimeType left, RuntimeType right);
+TypedUnaryOperator get_typed_unary_operator(const std::string &op, RuntimeType operand);
 
 #include "interpreter.tpp"
 
@@ -1,10 +1,19 @@
 
+/// Only ints and longs are ever changed in place, so comparisons can share two booleans rather than allocating
+template<typename T>
+inline spRuntimeValue make_basic_value(T value) {
+    return std::make_shared<typename BasicRuntimeType<T>::type>(value);
+}
+inline spRuntimeValue make_basic_value(bool value) {
+    static const spRuntimeValue true_value = std::make_shared<BooleanRuntimeValue>(true);
+    static const spRuntimeValue false_value = std::make_shared<BooleanRuntimeValue>(false);
+    return value ? true_value : false_value;
+}
+
 /// Macro for a case in a switch statement to perform the given operation with the given type, if value is of that type
 #define OP_WITH(type_, op_) case BasicRuntimeType<type_>::runtime_type: { \
     typedef BasicRuntimeType<type_>::type& rhs_type; \
-    typedef decltype(value op_ dynamic_cast<rhs_type>(right).m_value) result_type; \
-    typedef typename BasicRuntimeType<result_type>::type result_runtime_type; \
-    return std::make_unique<result_runtime_type>(value op_ dynamic_cast<rhs_type>(right).m_value); \
+    return make_basic_value(value op_ dynamic_cast<rhs_type>(right).m_value); \
 }
 
 
@@ -74,7 +83,7 @@ INT_OP(>>, right_shift)
 /// Unary operators
 #define UNARY_OP(op_) template<typename T, RuntimeType TYPE> \
 spRuntimeValue BasicRuntimeValue<T, TYPE>::operator op_() { \
-    return std::make_unique<typename BasicRuntimeType<decltype(op_ m_value)>::type>(op_ m_value); \
+    return make_basic_value(op_ m_value); \
 }
 UNARY_OP(!)
 UNARY_OP(+)
@@ -98,8 +107,7 @@ struct operator_bitnot<T, false> {
 template<typename T>
 struct operator_bitnot<T, true> {
     inline spRuntimeValue operator()(T value, RuntimeValue &operand) {
-        typedef typename BasicRuntimeType<decltype(~value)>::type result_type;
-        return std::make_unique<result_type>(~value);
+        return make_basic_value(~value);
     }
 };
 template<typename T, RuntimeType TYPE>
@@ -108,15 +116,29 @@ spRuntimeValue BasicRuntimeValue<T, TYPE>::operator~() {
 }
 
 template<typename T>
-struct basic_to_string {
-    inline std::string operator()(T value) { return std::to_string(value); }
+struct basic_append_to {};
+template<>
+struct basic_append_to<int32_t> {
+    inline void operator()(std::string &out, int32_t value) { append_int(out, value); }
+};
+template<>
+struct basic_append_to<int64_t> {
+    inline void operator()(std::string &out, int64_t value) { append_int(out, value); }
+};
+template<>
+struct basic_append_to<float> {
+    inline void operator()(std::string &out, float value) { append_float(out, value); }
+};
+template<>
+struct basic_append_to<double> {
+    inline void operator()(std::string &out, double value) { append_double(out, value); }
 };
 template<>
-struct basic_to_string<bool> {
-    inline std::string operator()(bool value) { return value ? "true" : "false"; }
+struct basic_append_to<bool> {
+    inline void operator()(std::string &out, bool value) { out += value ? "true" : "false"; }
 };
 
 template<typename T, RuntimeType TYPE>
-std::string BasicRuntimeValue<T, TYPE>::to_string() {
-    return basic_to_string<T>()(m_value);
+void BasicRuntimeValue<T, TYPE>::append_to(std::string &out) {
+    basic_append_to<T>()(out, m_value);
 }
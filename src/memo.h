@@ -0,0 +1,75 @@
+
+#ifndef DECODE_BIN_MEMO_H
+#define DECODE_BIN_MEMO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include "input.h"
+
+class RuntimeValue;
+class Struct;
+
+/// Everything decoding a struct did, so that decoding it again from the same place can be skipped
+struct StructMemoEntry {
+    std::shared_ptr<RuntimeValue> value;
+    // in bits, see Input::bit_position()
+    uint64_t end_position;
+    ByteOrder end_byte_order;
+    // what the body appended to the output, which is only valid at the same depth and visibility
+    std::string output;
+    int output_depth;
+    bool hidden;
+    bool output_line_start;
+};
+
+/// Decoded closed structs (see Struct::m_closed) by where they were decoded, for --memo. Holds at most capacity
+/// entries, the oldest are evicted first.
+class StructMemo {
+public:
+    // where it starts in bits
+    typedef std::tuple<Struct*, uint64_t, ByteOrder> Key;
+private:
+    std::map<Key, StructMemoEntry> m_entries;
+    std::deque<Key> m_insertion_order;
+    size_t m_capacity;
+public:
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_evictions = 0;
+
+    explicit StructMemo(size_t capacity) : m_capacity(capacity) {}
+
+    size_t size() { return m_entries.size(); }
+
+    // returns nullptr if there is no entry
+    StructMemoEntry *find(const Key &key) {
+        auto itr = m_entries.find(key);
+        return itr == m_entries.end() ? nullptr : &itr->second;
+    }
+
+    void insert(const Key &key, StructMemoEntry entry) {
+        if (m_capacity == 0)
+            return;
+        if (!m_entries.emplace(key, std::move(entry)).second)
+            return;
+        m_insertion_order.push_back(key);
+        if (m_entries.size() > m_capacity) {
+            m_entries.erase(m_insertion_order.front());
+            m_insertion_order.pop_front();
+            m_evictions++;
+        }
+    }
+
+    // entries are only valid for one input, the counters are kept
+    void clear() {
+        m_entries.clear();
+        m_insertion_order.clear();
+    }
+};
+
+#endif //DECODE_BIN_MEMO_H
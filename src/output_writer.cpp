@@ -0,0 +1,42 @@
+
+#include "output_writer.h"
+
+using namespace std;
+
+OutputWriter::OutputWriter(FILE *file, size_t depth) : m_file(file), m_full(depth), m_empty(depth) {
+    m_thread = thread([this]() { run(); });
+}
+
+OutputWriter::~OutputWriter() {
+    m_full.close();
+    m_thread.join();
+}
+
+void OutputWriter::run() {
+    string buffer;
+    while (m_full.pop(buffer)) {
+        fwrite(buffer.data(), 1, buffer.size(), m_file);
+        // while there is more to write it can wait in the FILE's buffer
+        if (m_full.size() == 0)
+            fflush(m_file);
+        buffer.clear();
+        m_empty.try_push(buffer);
+        lock_guard<mutex> lock(m_written_mutex);
+        m_written++;
+        m_written_changed.notify_all();
+    }
+    fflush(m_file);
+}
+
+void OutputWriter::write(string &buffer) {
+    if (m_full.push(buffer))
+        m_stalls++;
+    m_handed++;
+    if (!m_empty.try_pop(buffer))
+        buffer = string();
+}
+
+void OutputWriter::drain() {
+    unique_lock<mutex> lock(m_written_mutex);
+    m_written_changed.wait(lock, [this]() { return m_written == m_handed; });
+}
@@ -0,0 +1,43 @@
+
+#ifndef DECODE_BIN_OUTPUT_WRITER_H
+#define DECODE_BIN_OUTPUT_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "spsc_ring.h"
+
+/// Writes output on a thread of its own, for --pipeline, so the interpreter doesn't wait for the file or terminal.
+/// Buffers are written in the order they're handed over, so the output is the same as writing them directly. Once
+/// depth buffers are waiting the interpreter waits too, and written buffers are given back to be filled again.
+class OutputWriter {
+    FILE *m_file;
+    SpscRing<std::string> m_full;
+    SpscRing<std::string> m_empty;
+    // buffers handed over, and written and flushed, for drain()
+    uint64_t m_handed = 0;
+    uint64_t m_written = 0;
+    std::mutex m_written_mutex;
+    std::condition_variable m_written_changed;
+    std::thread m_thread;
+
+    void run();
+public:
+    // how many times write() had to wait for the file
+    uint64_t m_stalls = 0;
+
+    OutputWriter(FILE *file, size_t depth);
+    ~OutputWriter();
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter &operator=(const OutputWriter&) = delete;
+
+    // hands the buffer over to be written and replaces it with an empty one
+    void write(std::string &buffer);
+    // waits until everything handed over has been written and flushed
+    void drain();
+};
+
+#endif //DECODE_BIN_OUTPUT_WRITER_H
@@ -2,6 +2,7 @@
 #include "parser.h"
 #include "util.h"
 #include "interpreter.h"
+#include "utf8.h"
 #include <limits>
 
 using namespace std;
@@ -48,6 +49,8 @@ public:
             return do_while_statement();
         } else if (first_token.value == "switch") {
             return switch_statement();
+        } else if (first_token.value == "deflate") {
+            return deflate_statement();
         } else if (first_token.value == "break") {
             return break_statement();
         } else if (first_token.value == "continue") {
@@ -116,6 +119,19 @@ public:
         return ret;
     }
 
+    upStatement deflate_statement() {
+        auto ret = make_unique<DeflateStatement>(peek());
+        advance(); // deflate
+        if (peek().value != "(") throw peek();
+        advance(); // (
+        ret->m_length = expression();
+        if (peek().value != ")") throw peek();
+        advance(); // )
+        ret->m_body = statement();
+        ret->m_end_token = ret->m_body->m_end_token;
+        return ret;
+    }
+
     upStatement do_while_statement() {
         auto ret = make_unique<DoWhileStatement>(peek());
         advance(); // do
@@ -224,7 +240,9 @@ public:
         auto ret = make_unique<AssignmentStatement>(peek());
         ret->m_name = peek().value;
         advance(); // name
+        ret->m_op = peek().value;
         ret->m_operator = get_assignment_operator(peek().value);
+        ret->m_in_place = get_in_place_operator(peek().value);
         ret->m_is_assign_only = peek().value == "=";
         advance(); // operator
         ret->m_value = expression();
@@ -253,32 +271,28 @@ public:
         if (peek().value != ";") throw peek();
         Token end_token = peek();
         advance(); // ;
-        // turn "i++" into "i = i + 1"
+        // turn "i++" into "i += 1", which can be done in place
         auto ret = make_unique<AssignmentStatement>(begin_token);
         ret->m_end_token = end_token;
         ret->m_name = var;
-        ret->m_operator = get_assignment_operator("=");
-        ret->m_is_assign_only = true;
-        auto val = make_unique<BinaryOperatorExpression>(begin_token);
-        val->m_end_token = end_token;
-        auto left = make_unique<VarReferenceExpression>(begin_token);
-        left->m_end_token = end_token;
-        left->m_name = var;
-        val->m_left = move(left);
-        auto right = make_unique<LiteralExpression>(begin_token);
-        right->m_end_token = end_token;
-        right->m_value = make_shared<IntegerRuntimeValue>(1);
-        val->m_right = move(right);
-        if (op == "++") val->m_operator = [](RuntimeValue &left, Expression &right, InterpreterContext &context) { return left + *context.evaluate_expression(right); };
-        else val->m_operator = [](RuntimeValue &left, Expression &right, InterpreterContext &context) { return left - *context.evaluate_expression(right); };
-        ret->m_value = move(val);
+        ret->m_op = op == "++" ? "+=" : "-=";
+        ret->m_operator = get_assignment_operator(ret->m_op);
+        ret->m_in_place = get_in_place_operator(ret->m_op);
+        ret->m_is_assign_only = false;
+        auto one = make_unique<LiteralExpression>(begin_token);
+        one->m_end_token = end_token;
+        one->m_value = make_shared<IntegerRuntimeValue>(1);
+        ret->m_value = move(one);
         return ret;
     }
 
     upStatement builtin_function_statement() {
         auto ret = make_unique<BuiltinFunctionStatement>(peek());
+        Token name_token = peek();
         ret->m_name = peek().value;
         if (!is_valid_identifier(ret->m_name)) throw peek();
+        ret->m_function = find_builtin_function(ret->m_name);
+        if (!ret->m_function) throw peek();
         advance(); // name
         advance(); // (
         if (peek().value != ")") {
@@ -290,6 +304,7 @@ public:
                 advance(); // ,
             }
         }
+        if (!check_builtin_arity(*ret->m_function, ret->m_args.size())) throw name_token;
         advance(); // )
         if (peek().value != ";") throw peek();
         ret->m_end_token = peek();
@@ -297,6 +312,10 @@ public:
         return ret;
     }
 
+    bool check_builtin_arity(const BuiltinFunction &function, size_t arg_count) {
+        return arg_count >= function.min_args && arg_count <= function.max_args;
+    }
+
     upStatement struct_ref_statement() {
         auto ret = make_unique<StructRefStatement>(peek());
         ret->m_type = struct_ref();
@@ -341,6 +360,7 @@ public:
         ret->m_left = move(expr); \
         ret->m_right = expression##level_(); \
         ret->m_end_token = ret->m_right->m_end_token; \
+        ret->m_op = #operator_; \
         ret->m_operator = [](RuntimeValue &left, Expression &right, InterpreterContext &context){return left operator_ *context.evaluate_expression(right);}; \
         return ret; \
     } \
@@ -355,6 +375,7 @@ public:
         ret->m_left = move(expr); \
         ret->m_right = expression##level_(); \
         ret->m_end_token = ret->m_right->m_end_token; \
+        ret->m_op = op; \
         if (op == #operator1_) \
             ret->m_operator = [](RuntimeValue &left, Expression &right, InterpreterContext &context){return left operator1_ *context.evaluate_expression(right);}; \
         else \
@@ -372,6 +393,7 @@ public:
         ret->m_left = move(expr); \
         ret->m_right = expression##level_(); \
         ret->m_end_token = ret->m_right->m_end_token; \
+        ret->m_op = op; \
         if (op == #operator1_) \
             ret->m_operator = [](RuntimeValue &left, Expression &right, InterpreterContext &context){return left operator1_ *context.evaluate_expression(right);}; \
         else if (op == #operator2_) \
@@ -391,6 +413,7 @@ public:
         ret->m_left = move(expr); \
         ret->m_right = expression##level_(); \
         ret->m_end_token = ret->m_right->m_end_token; \
+        ret->m_op = op; \
         if (op == #operator1_) \
             ret->m_operator = [](RuntimeValue &left, Expression &right, InterpreterContext &context){return left operator1_ *context.evaluate_expression(right);}; \
         else if (op == #operator2_) \
@@ -418,6 +441,7 @@ public:
         if (peek().value == "+" || peek().value == "-" || peek().value == "!" || peek().value == "~") {
             string op = peek().value;
             auto ret = make_unique<UnaryOperatorExpression>(peek());
+            ret->m_op = op;
             advance(); // op
             if (op == "+") ret->m_operator = [](RuntimeValue &val){return +val;};
             else if (op == "-") ret->m_operator = [](RuntimeValue &val){return -val;};
@@ -459,7 +483,10 @@ public:
         string name = peek().value;
         if (is_valid_identifier(name) && next_token.value == "(") {
             auto ret = make_unique<BuiltinFunctionExpression>(peek());
+            Token name_token = peek();
             ret->m_name = name;
+            ret->m_function = find_builtin_function(name);
+            if (!ret->m_function || !ret->m_function->returns_value) throw peek();
             advance(); // name
             advance(); // (
             if (peek().value != ")") {
@@ -471,6 +498,7 @@ public:
                     advance(); // ,
                 }
             }
+            if (!check_builtin_arity(*ret->m_function, ret->m_args.size())) throw name_token;
             ret->m_end_token = peek();
             advance(); // )
             return ret;
@@ -494,7 +522,8 @@ public:
             auto ret = make_unique<BinaryOperatorExpression>(expr->m_begin_token);
             ret->m_left = move(expr);
             ret->m_right = expression();
-            ret->m_operator = [](RuntimeValue &left, Expression &right, InterpreterContext &context){ return left[*context.evaluate_expression(right)]; };
+            ret->m_op = "[]";
+            ret->m_operator = [](RuntimeValue &left, Expression &right, InterpreterContext &context){ return context.index_array(left, *context.evaluate_expression(right)); };
             if (peek().value != "]") throw peek();
             ret->m_end_token = peek();
             advance(); // ]
@@ -535,6 +564,10 @@ public:
             advance(); // false
             ret->m_value = make_shared<BooleanRuntimeValue>(false);
             return ret;
+        } else if (!first_token.value.empty() && first_token.value[0] == '"') {
+            return string_literal_expression();
+        } else if (!first_token.value.empty() && first_token.value[0] == '\'') {
+            return char_literal_expression();
         } else if (!first_token.value.empty() && (is_digit(first_token.value[0]) || (first_token.value.length() > 1 && first_token.value[0] == '.' && is_digit(first_token.value[1])))) {
             return literal_expression();
         } else if (is_valid_identifier(first_token.value)) {
@@ -678,6 +711,73 @@ public:
         return ret;
     }
 
+    // the contents of a string or char literal without the quotes, with escape sequences replaced
+    string unescape(const string &literal) {
+        string ret;
+        for (size_t i = 1; i < literal.length() - 1; i++) {
+            if (literal[i] != '\\') {
+                ret += literal[i];
+                continue;
+            }
+            i++;
+            switch (literal[i]) {
+                case 'n': ret += '\n'; break;
+                case 'r': ret += '\r'; break;
+                case 't': ret += '\t'; break;
+                case '0': ret += '\0'; break;
+                case '\\': ret += '\\'; break;
+                case '"': ret += '"'; break;
+                case '\'': ret += '\''; break;
+                case 'x':
+                case 'u': {
+                    size_t digits = literal[i] == 'x' ? 2 : 4;
+                    if (i + digits >= literal.length()) throw peek();
+                    uint32_t code_point = 0;
+                    for (size_t j = 0; j < digits; j++) {
+                        char ch = literal[++i];
+                        if (!is_digit(ch, Radix::HEX)) throw peek();
+                        code_point = code_point * 16 + (is_digit(ch) ? ch - '0' : ch >= 'a' ? ch - 'a' + 10 : ch - 'A' + 10);
+                    }
+                    append_utf8(ret, code_point);
+                    break;
+                }
+                default:
+                    throw peek();
+            }
+        }
+        return ret;
+    }
+
+    upExpression string_literal_expression() {
+        auto ret = make_unique<LiteralExpression>(peek());
+        ret->m_end_token = peek();
+        ret->m_value = make_shared<StringRuntimeValue>(unescape(peek().value));
+        advance(); // literal
+        return ret;
+    }
+
+    // char literals are the integer value of the code point
+    upExpression char_literal_expression() {
+        auto ret = make_unique<LiteralExpression>(peek());
+        ret->m_end_token = peek();
+        string value = unescape(peek().value);
+        uint32_t code_point;
+        // decode the single character back out of UTF-8
+        if (value.length() == 1) {
+            code_point = static_cast<uint8_t>(value[0]);
+        } else {
+            string reencoded;
+            code_point = 0;
+            for (size_t i = 0; i < value.length(); i++)
+                code_point = (code_point << 6) | (static_cast<uint8_t>(value[i]) & (i == 0 ? 0x7fu >> value.length() : 0x3fu));
+            append_utf8(reencoded, code_point);
+            if (reencoded != value) throw peek();
+        }
+        ret->m_value = make_shared<IntegerRuntimeValue>(static_cast<int32_t>(code_point));
+        advance(); // literal
+        return ret;
+    }
+
     upExpression var_reference_expression() {
         auto ret = make_unique<VarReferenceExpression>(peek());
         ret->m_end_token = peek();
@@ -695,6 +795,7 @@ public:
     }
 
     upStructRef struct_ref() {
+        Token begin_token = peek();
         bool is_decl = false;
         map<StructModifierType, shared_ptr<void>> modifiers;
 
@@ -733,6 +834,7 @@ public:
 
         if (is_decl) {
             auto struct_def = make_unique<Struct>();
+            struct_def->m_begin_token = begin_token;
             struct_def->m_type = type;
             struct_def->m_modifiers = modifiers;
             struct_def->m_name = nullptr;
@@ -747,6 +849,7 @@ public:
             while (peek().value != "}") {
                 struct_def->m_body.push_back(statement());
             }
+            struct_def->m_end_token = peek();
             advance(); // }
             auto ret = make_unique<DeclaringStructRef>();
             ret->m_declaration = move(struct_def);
@@ -0,0 +1,51 @@
+
+#ifndef DECODE_BIN_PROFILE_H
+#define DECODE_BIN_PROFILE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class Statement;
+class Struct;
+
+struct ProfileEntry {
+    uint64_t count = 0;
+    uint64_t inclusive_ns = 0;
+    // inclusive time minus the time spent in profiled children
+    uint64_t exclusive_ns = 0;
+    uint64_t bytes = 0;
+};
+
+/// Collects execution counts, times and bytes consumed for each statement and struct, for --profile
+class Profiler {
+    struct Frame {
+        std::chrono::steady_clock::time_point start;
+        uint64_t child_ns;
+        size_t start_offset;
+    };
+    std::vector<Frame> m_stack;
+public:
+    std::unordered_map<Statement*, ProfileEntry> m_statements;
+    std::unordered_map<Struct*, ProfileEntry> m_structs;
+
+    // calls must be paired, offset is the input offset
+    void begin(size_t offset) {
+        m_stack.push_back({std::chrono::steady_clock::now(), 0, offset});
+    }
+    void end(ProfileEntry &entry, size_t offset) {
+        Frame &frame = m_stack.back();
+        auto elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frame.start).count());
+        entry.count++;
+        entry.inclusive_ns += elapsed;
+        entry.exclusive_ns += elapsed - frame.child_ns;
+        entry.bytes += offset - frame.start_offset;
+        m_stack.pop_back();
+        if (!m_stack.empty())
+            m_stack.back().child_ns += elapsed;
+    }
+};
+
+#endif //DECODE_BIN_PROFILE_H
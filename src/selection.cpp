@@ -0,0 +1,85 @@
+
+#include "selection.h"
+#include "util.h"
+
+using namespace std;
+
+Selection::Selection(const string &paths) {
+    size_t start = 0;
+    while (start <= paths.length()) {
+        size_t end = paths.find(',', start);
+        if (end == string::npos)
+            end = paths.length();
+        string path = paths.substr(start, end - start);
+        start = end + 1;
+
+        vector<string> segments;
+        size_t segment_start = 0;
+        while (segment_start <= path.length()) {
+            size_t segment_end = path.find('.', segment_start);
+            if (segment_end == string::npos)
+                segment_end = path.length();
+            string segment = path.substr(segment_start, segment_end - segment_start);
+            if (segment.empty() || segment[0] == '[')
+                throw "Invalid path " + path;
+            segments.push_back(move(segment));
+            segment_start = segment_end + 1;
+        }
+        m_paths.push_back(move(segments));
+    }
+    if (m_paths.size() > MAX_SELECTED_PATHS)
+        throw "At most " + to_string(MAX_SELECTED_PATHS) + " paths can be selected";
+}
+
+uint64_t Selection::all_paths() const {
+    return m_paths.size() == 64 ? ~uint64_t(0) : (uint64_t(1) << m_paths.size()) - 1;
+}
+
+/// e.g. constant_pool matches constant_pool and constant_pool[3], constant_pool[*] matches constant_pool[3]
+static bool segment_matches(const string &segment, const string &name) {
+    if (segment.find('[') == string::npos) {
+        return name.compare(0, segment.length(), segment) == 0
+                && (name.length() == segment.length() || name[segment.length()] == '[');
+    }
+    size_t i = 0, j = 0;
+    while (i < segment.length() && j < name.length()) {
+        if (segment[i] == '*') {
+            if (!is_digit(name[j]))
+                return false;
+            while (j < name.length() && is_digit(name[j]))
+                j++;
+            i++;
+        } else if (segment[i] == name[j]) {
+            i++;
+            j++;
+        } else {
+            return false;
+        }
+    }
+    // leaving out trailing dimensions of a multidimensional array selects all of them
+    return i == segment.length() && (j == name.length() || name[j] == '[');
+}
+
+void Selection::match(uint64_t candidates, size_t depth, const string &name, uint64_t &continuing, bool &selected) const {
+    continuing = 0;
+    selected = false;
+    for (size_t i = 0; i < m_paths.size(); i++) {
+        if (!(candidates & (uint64_t(1) << i)) || depth >= m_paths[i].size() || !segment_matches(m_paths[i][depth], name))
+            continue;
+        if (depth + 1 == m_paths[i].size())
+            selected = true;
+        else
+            continuing |= uint64_t(1) << i;
+    }
+}
+
+bool Selection::mentions(uint64_t candidates, size_t depth, const string &field) const {
+    for (size_t i = 0; i < m_paths.size(); i++) {
+        if ((candidates & (uint64_t(1) << i)) && depth < m_paths[i].size()) {
+            const string &segment = m_paths[i][depth];
+            if (segment.compare(0, segment.find('['), field) == 0)
+                return true;
+        }
+    }
+    return false;
+}
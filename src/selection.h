@@ -0,0 +1,29 @@
+
+#ifndef DECODE_BIN_SELECTION_H
+#define DECODE_BIN_SELECTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+const size_t MAX_SELECTED_PATHS = 64;
+
+/// The paths given to --select, e.g. "magic,constant_pool[*].tag". Each segment of a path matches one level of
+/// struct refs by name. A segment without indices matches a field and every element of it, and * matches any index.
+/// Sets of paths are bitmasks, so that each struct ref can remember which paths it is on cheaply.
+class Selection {
+    std::vector<std::vector<std::string>> m_paths;
+public:
+    // comma separated paths, throws a message if one is malformed
+    explicit Selection(const std::string &paths);
+
+    uint64_t all_paths() const;
+    // Which of the paths in candidates continue through a struct ref with this name, depth levels down, and whether
+    // any of them ends there, which selects the struct ref and everything in it
+    void match(uint64_t candidates, size_t depth, const std::string &name, uint64_t &continuing, bool &selected) const;
+    // whether any of the paths in candidates could match an element or the whole of a field with this name
+    bool mentions(uint64_t candidates, size_t depth, const std::string &field) const;
+};
+
+#endif //DECODE_BIN_SELECTION_H
@@ -0,0 +1,96 @@
+
+#ifndef DECODE_BIN_SPSC_RING_H
+#define DECODE_BIN_SPSC_RING_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/// A bounded queue from one producer thread to one consumer thread. Pushing and popping don't lock, only waiting for
+/// room or for an item does, so a stage which keeps up never holds up the other.
+template<typename T>
+class SpscRing {
+    std::vector<T> m_slots;
+    // only the consumer moves m_head and only the producer moves m_tail, items are in slot index % capacity
+    std::atomic<size_t> m_head{0};
+    std::atomic<size_t> m_tail{0};
+    std::atomic<bool> m_closed{false};
+    // Only for sleeping: a thread about to wait counts itself in m_waiting before checking again, and the other side
+    // checks m_waiting after moving its index, so one of them always sees the other.
+    std::atomic<int> m_waiting{0};
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+
+    void notify() {
+        if (m_waiting.load() == 0)
+            return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_changed.notify_all();
+    }
+
+    template<typename Predicate>
+    void wait(Predicate ready) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiting++;
+        m_changed.wait(lock, ready);
+        m_waiting--;
+    }
+
+public:
+    explicit SpscRing(size_t capacity) : m_slots(capacity) {}
+
+    size_t size() { return m_tail.load() - m_head.load(); }
+
+    // producer: returns false without taking item if the ring is full
+    bool try_push(T &item) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load() == m_slots.size())
+            return false;
+        m_slots[tail % m_slots.size()] = std::move(item);
+        m_tail.store(tail + 1);
+        notify();
+        return true;
+    }
+
+    // producer: waits while the ring is full, returns true if it had to
+    bool push(T &item) {
+        if (try_push(item))
+            return false;
+        while (!try_push(item))
+            wait([this]() { return m_tail.load() - m_head.load() < m_slots.size(); });
+        return true;
+    }
+
+    // consumer: returns false if the ring is empty
+    bool try_pop(T &item) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load())
+            return false;
+        item = std::move(m_slots[head % m_slots.size()]);
+        m_head.store(head + 1);
+        notify();
+        return true;
+    }
+
+    // consumer: waits while the ring is empty, returns false once it is empty and closed
+    bool pop(T &item) {
+        while (!try_pop(item)) {
+            if (m_closed.load() && size() == 0)
+                return false;
+            wait([this]() { return m_tail.load() != m_head.load() || m_closed.load(); });
+        }
+        return true;
+    }
+
+    // producer: nothing more will be pushed
+    void close() {
+        m_closed.store(true);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_changed.notify_all();
+    }
+};
+
+#endif //DECODE_BIN_SPSC_RING_H
@@ -0,0 +1,141 @@
+
+#include "utf8.h"
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+static const uint32_t REPLACEMENT_CHARACTER = 0xfffd;
+
+bool append_utf8(string &out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out += static_cast<char>(code_point);
+    } else if (code_point < 0x800) {
+        out += static_cast<char>(0xc0 | (code_point >> 6));
+        out += static_cast<char>(0x80 | (code_point & 0x3f));
+    } else if (code_point < 0x10000) {
+        // lone surrogates can't be represented in UTF-8
+        if (code_point >= 0xd800 && code_point <= 0xdfff)
+            code_point = REPLACEMENT_CHARACTER;
+        out += static_cast<char>(0xe0 | (code_point >> 12));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code_point & 0x3f));
+    } else if (code_point < 0x110000) {
+        out += static_cast<char>(0xf0 | (code_point >> 18));
+        out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code_point & 0x3f));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// Returns the number of bytes at the start of data which are ASCII
+static size_t ascii_prefix_length(const uint8_t *data, size_t length) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // 16 bytes at a time, the top bit of each byte ends up in the mask
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        if (_mm_movemask_epi8(chunk) != 0)
+            break;
+    }
+#endif
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if ((word & 0x8080808080808080ULL) != 0)
+            break;
+    }
+    while (i < length && data[i] < 0x80)
+        i++;
+    return i;
+}
+
+/// Decodes a multi-byte sequence starting at data[0], returning its length or 0 if it's malformed.
+/// Overlong encodings are not rejected here.
+static size_t decode_sequence(const uint8_t *data, size_t length, uint32_t &code_point) {
+    uint8_t lead = data[0];
+    size_t size;
+    if ((lead & 0xe0) == 0xc0) {
+        size = 2;
+        code_point = lead & 0x1fu;
+    } else if ((lead & 0xf0) == 0xe0) {
+        size = 3;
+        code_point = lead & 0x0fu;
+    } else if ((lead & 0xf8) == 0xf0) {
+        size = 4;
+        code_point = lead & 0x07u;
+    } else {
+        return 0;
+    }
+    if (length < size)
+        return 0;
+    for (size_t i = 1; i < size; i++) {
+        if ((data[i] & 0xc0) != 0x80)
+            return 0;
+        code_point = (code_point << 6) | (data[i] & 0x3fu);
+    }
+    return size;
+}
+
+bool decode_utf8(const uint8_t *data, size_t length, string &out) {
+    out.reserve(out.size() + length);
+    size_t i = 0;
+    while (true) {
+        size_t ascii = ascii_prefix_length(data + i, length - i);
+        out.append(reinterpret_cast<const char*>(data + i), ascii);
+        i += ascii;
+        if (i == length)
+            return true;
+
+        uint32_t code_point;
+        size_t size = decode_sequence(data + i, length - i, code_point);
+        if (size == 0)
+            return false;
+        static const uint32_t min_code_point[] = {0, 0, 0x80, 0x800, 0x10000};
+        if (code_point < min_code_point[size] || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff))
+            return false;
+        // valid UTF-8 is already in the output encoding
+        out.append(reinterpret_cast<const char*>(data + i), size);
+        i += size;
+    }
+}
+
+bool decode_modified_utf8(const uint8_t *data, size_t length, string &out) {
+    out.reserve(out.size() + length);
+    size_t i = 0;
+    while (true) {
+        size_t ascii = ascii_prefix_length(data + i, length - i);
+        out.append(reinterpret_cast<const char*>(data + i), ascii);
+        i += ascii;
+        if (i == length)
+            return true;
+
+        uint32_t code_point;
+        size_t size = decode_sequence(data + i, length - i, code_point);
+        if (size == 2) {
+            // the only overlong form allowed is the two byte encoding of NUL
+            if (code_point < 0x80 && code_point != 0)
+                return false;
+        } else if (size == 3) {
+            if (code_point < 0x800)
+                return false;
+            if (code_point >= 0xd800 && code_point <= 0xdbff) {
+                uint32_t low;
+                if (length - i >= 6 && decode_sequence(data + i + 3, length - i - 3, low) == 3 && low >= 0xdc00 && low <= 0xdfff) {
+                    code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                    size = 6;
+                }
+            }
+        } else {
+            // 4 byte sequences don't exist in modified UTF-8
+            return false;
+        }
+        append_utf8(out, code_point);
+        i += size;
+    }
+}
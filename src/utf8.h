@@ -0,0 +1,18 @@
+
+#ifndef DECODE_BIN_UTF8_H
+#define DECODE_BIN_UTF8_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// returns false if the code point is out of range
+bool append_utf8(std::string &out, uint32_t code_point);
+
+// These validate the input and append it to out as standard UTF-8, returning false on malformed input.
+// Runs of ASCII are copied in bulk.
+bool decode_utf8(const uint8_t *data, size_t length, std::string &out);
+// Java's modified UTF-8: NUL is encoded as two bytes and supplementary characters as surrogate pairs
+bool decode_modified_utf8(const uint8_t *data, size_t length, std::string &out);
+
+#endif //DECODE_BIN_UTF8_H
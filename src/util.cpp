@@ -11,7 +11,7 @@ bool is_valid_identifier(std::string &name) {
         return false;
     if (KEYWORDS.find(name) != KEYWORDS.end())
         return false;
-    if (is_digit(name[0]) || name[0] == '.')
+    if (is_digit(name[0]) || name[0] == '.' || name[0] == '"' || name[0] == '\'')
         return false;
     return true;
 }
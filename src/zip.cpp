@@ -0,0 +1,156 @@
+
+#include "zip.h"
+#include <algorithm>
+#include <zlib.h>
+#include "compression.h"
+
+using namespace std;
+
+const uint32_t LOCAL_HEADER_SIGNATURE = 0x04034b50;
+const uint32_t CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+const uint32_t END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06054b50;
+const uint32_t ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06064b50;
+const uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+const uint16_t ZIP64_EXTRA_FIELD = 0x0001;
+const size_t END_OF_CENTRAL_DIRECTORY_SIZE = 22;
+const size_t ZIP64_LOCATOR_SIZE = 20;
+// deflate can't compress by more than this, which bounds the size to reserve for an entry whatever its header says
+const uint64_t MAX_DEFLATE_RATIO = 1032;
+const uint64_t MAX_ENTRY_RESERVE = 1 << 26;
+
+/// Little endian fields at offsets in the archive. Reads aren't bounds checked, callers check with has() first.
+class ZipReader {
+    const vector<uint8_t> &m_archive;
+public:
+    explicit ZipReader(const vector<uint8_t> &archive) : m_archive(archive) {}
+
+    bool has(uint64_t offset, uint64_t length) {
+        return offset <= m_archive.size() && length <= m_archive.size() - offset;
+    }
+
+    uint64_t read(uint64_t offset, int size) {
+        uint64_t value = 0;
+        for (int i = size - 1; i >= 0; i--)
+            value = (value << 8) | m_archive[offset + i];
+        return value;
+    }
+    uint16_t u2(uint64_t offset) { return static_cast<uint16_t>(read(offset, 2)); }
+    uint32_t u4(uint64_t offset) { return static_cast<uint32_t>(read(offset, 4)); }
+    uint64_t u8(uint64_t offset) { return read(offset, 8); }
+};
+
+bool read_zip_directory(const vector<uint8_t> &archive, vector<ZipEntry> &entries, string &error) {
+    ZipReader zip(archive);
+    // the end of central directory record is last, followed only by a comment of up to 64K
+    if (archive.size() < END_OF_CENTRAL_DIRECTORY_SIZE) {
+        error = "Not a ZIP archive";
+        return false;
+    }
+    uint64_t end = archive.size() - END_OF_CENTRAL_DIRECTORY_SIZE;
+    uint64_t limit = end > 0xffff ? end - 0xffff : 0;
+    while (zip.u4(end) != END_OF_CENTRAL_DIRECTORY_SIGNATURE) {
+        if (end == limit) {
+            error = "Not a ZIP archive";
+            return false;
+        }
+        end--;
+    }
+
+    uint64_t entry_count = zip.u2(end + 10);
+    uint64_t directory_size = zip.u4(end + 12);
+    uint64_t directory_offset = zip.u4(end + 16);
+    if (end >= ZIP64_LOCATOR_SIZE && zip.u4(end - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIGNATURE) {
+        uint64_t zip64_end = zip.u8(end - ZIP64_LOCATOR_SIZE + 8);
+        if (!zip.has(zip64_end, 56) || zip.u4(zip64_end) != ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE) {
+            error = "Invalid ZIP64 end of central directory";
+            return false;
+        }
+        entry_count = zip.u8(zip64_end + 32);
+        directory_size = zip.u8(zip64_end + 40);
+        directory_offset = zip.u8(zip64_end + 48);
+    }
+    if (!zip.has(directory_offset, directory_size)) {
+        error = "Central directory is outside the archive";
+        return false;
+    }
+
+    uint64_t offset = directory_offset;
+    for (uint64_t i = 0; i < entry_count; i++) {
+        if (!zip.has(offset, 46) || zip.u4(offset) != CENTRAL_HEADER_SIGNATURE) {
+            error = "Invalid central directory entry " + to_string(i);
+            return false;
+        }
+        ZipEntry entry;
+        entry.method = zip.u2(offset + 10);
+        entry.crc = zip.u4(offset + 16);
+        entry.compressed_size = zip.u4(offset + 20);
+        entry.uncompressed_size = zip.u4(offset + 24);
+        uint16_t name_length = zip.u2(offset + 28);
+        uint16_t extra_length = zip.u2(offset + 30);
+        uint16_t comment_length = zip.u2(offset + 32);
+        entry.local_header_offset = zip.u4(offset + 42);
+        if (!zip.has(offset + 46, uint64_t(name_length) + extra_length + comment_length)) {
+            error = "Invalid central directory entry " + to_string(i);
+            return false;
+        }
+        entry.name.assign(reinterpret_cast<const char*>(archive.data() + offset + 46), name_length);
+
+        // ZIP64 sizes and offsets are in an extra field, only for the ones which didn't fit
+        uint64_t extra = offset + 46 + name_length;
+        for (uint64_t field = extra; field + 4 <= extra + extra_length;) {
+            uint16_t id = zip.u2(field);
+            uint16_t size = zip.u2(field + 2);
+            if (field + 4 + size > extra + extra_length) {
+                error = "Invalid extra field in central directory entry " + to_string(i);
+                return false;
+            }
+            if (id == ZIP64_EXTRA_FIELD) {
+                uint64_t value = field + 4;
+                for (uint64_t *large : {&entry.uncompressed_size, &entry.compressed_size, &entry.local_header_offset}) {
+                    if (*large == 0xffffffff && value + 8 <= field + 4 + size) {
+                        *large = zip.u8(value);
+                        value += 8;
+                    }
+                }
+            }
+            field += 4 + size;
+        }
+
+        entries.push_back(move(entry));
+        offset += 46 + name_length + extra_length + comment_length;
+    }
+    return true;
+}
+
+bool read_zip_entry(const vector<uint8_t> &archive, const ZipEntry &entry, vector<uint8_t> &data, string &error) {
+    ZipReader zip(archive);
+    uint64_t header = entry.local_header_offset;
+    if (!zip.has(header, 30) || zip.u4(header) != LOCAL_HEADER_SIGNATURE) {
+        error = "Invalid local header";
+        return false;
+    }
+    // the local header's name and extra field can differ from the central directory's
+    uint64_t start = header + 30 + zip.u2(header + 26) + zip.u2(header + 28);
+    if (!zip.has(start, entry.compressed_size)) {
+        error = "Entry data is outside the archive";
+        return false;
+    }
+    const uint8_t *compressed = archive.data() + start;
+
+    data.reserve(min({entry.uncompressed_size, entry.compressed_size * MAX_DEFLATE_RATIO, MAX_ENTRY_RESERVE}));
+    if (entry.method == 0) {
+        data.assign(compressed, compressed + entry.compressed_size);
+    } else if (entry.method == 8) {
+        if (!inflate_data(compressed, entry.compressed_size, Compression::RAW_DEFLATE, data, error))
+            return false;
+    } else {
+        error = "Unsupported compression method " + to_string(entry.method);
+        return false;
+    }
+
+    if (data.size() != entry.uncompressed_size || crc32_z(0, data.data(), data.size()) != entry.crc) {
+        error = "Entry is corrupt, its size or CRC doesn't match";
+        return false;
+    }
+    return true;
+}
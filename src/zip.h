@@ -0,0 +1,28 @@
+
+#ifndef DECODE_BIN_ZIP_H
+#define DECODE_BIN_ZIP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// An entry in the central directory of a ZIP archive, such as a jar
+struct ZipEntry {
+    std::string name;
+    uint16_t method;
+    uint32_t crc;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint64_t local_header_offset;
+
+    bool is_directory() const { return !name.empty() && name.back() == '/'; }
+};
+
+// Reads the central directory of a whole archive in memory, including ZIP64 archives. Returns false with a message if
+// it isn't a ZIP archive.
+bool read_zip_directory(const std::vector<uint8_t> &archive, std::vector<ZipEntry> &entries, std::string &error);
+
+// The contents of a stored or deflated entry, checked against its CRC
+bool read_zip_entry(const std::vector<uint8_t> &archive, const ZipEntry &entry, std::vector<uint8_t> &data, std::string &error);
+
+#endif //DECODE_BIN_ZIP_H